@@ -0,0 +1,77 @@
+#ifndef AUTHCACHE_H
+#define AUTHCACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+#include <memory>
+
+/****************************************************************************************
+ * AuthCache - Bounded cache of recent successful password checks, so a client that logs
+ *             in again within the TTL skips the memory-hard argon2 hash.
+ *
+ *             Passwords are never stored. Each entry is a 128-bit SipHash-2-4 MAC, under a
+ *             key drawn at startup, over the username, the password and the stored hash
+ *             and salt the password was verified against. A hit needs all four to match, so
+ *             an entry stops matching as soon as the user's stored credentials change, even
+ *             if the change came from another process. changePasswd also drops the user's
+ *             entries explicitly.
+ *
+ *             The table is a fixed array of 4-way buckets sized once from max_entries
+ *             (entry_bytes each), so memory is capped no matter the load; a full bucket
+ *             evicts its oldest entry. Buckets are guarded by striped locks.
+ *
+ ****************************************************************************************/
+
+class AuthCache
+{
+public:
+   static const size_t entry_bytes = 32;
+
+   // Entries per bucket, so also the smallest cache there can be
+   static const unsigned int ways = 4;
+
+   AuthCache(unsigned int ttl_secs, size_t max_entries);
+   ~AuthCache();
+
+   // True if this exact password was verified for the user, against the same stored
+   // hash and salt, within the TTL
+   bool lookup(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                                                     const std::vector<uint8_t> &salt);
+
+   // Records a successful check
+   void insert(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                                                     const std::vector<uint8_t> &salt);
+
+   // Drops every entry for the user
+   void invalidate(const char *name);
+
+private:
+   static const unsigned int num_stripes = 16;
+
+   // Aligned to its size, so an entry never straddles a cache line and a bucket covers
+   // whole lines
+   struct alignas(entry_bytes) Entry {
+      uint64_t name_tag = 0;     // keyed hash of the name alone, for invalidate
+      uint64_t mac[2] = {0, 0};
+      int64_t expires = 0;       // steady clock ms, 0 = empty
+   };
+   static_assert(sizeof(Entry) == entry_bytes, "cache entries changed size");
+   static_assert(alignof(Entry) == entry_bytes, "cache entries lost their alignment");
+
+   void computeMAC(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                   const std::vector<uint8_t> &salt, uint64_t mac[2]);
+   uint64_t nameTag(const char *name);
+   std::mutex &stripe(size_t bucket) { return _stripes[bucket % num_stripes]; };
+
+   int64_t _ttl_ms;
+   uint64_t _key[2][2];          // MAC key (two halves for 128 bits)
+   uint64_t _name_key[2];
+
+   std::vector<Entry> _entries;  // num buckets * ways
+   size_t _bucket_mask;
+   std::mutex _stripes[num_stripes];
+};
+
+#endif
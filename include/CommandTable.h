@@ -0,0 +1,62 @@
+#ifndef COMMANDTABLE_H
+#define COMMANDTABLE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+class TCPConn;
+
+/****************************************************************************************
+ * CommandTable - Registry of the commands a logged-in user can enter. Each command has a
+ *                fixed reply, queued by pointer so it is never copied, and/or a handler
+ *                for commands that do more than answer (change state, disconnect).
+ *
+ *                Lookups go through a perfect hash: whenever a command is added, a seed
+ *                is searched for that sends every name to its own slot, so a lookup
+ *                hashes the input once and compares against at most one name. Names are
+ *                matched without regard to case and nothing is allocated.
+ *
+ *                Commands are added at startup. Lookups are safe from any number of
+ *                threads once the server is running, but adds are not.
+ *
+ ****************************************************************************************/
+
+class CommandTable
+{
+public:
+   typedef void (*Handler)(TCPConn &conn);
+
+   struct Command {
+      std::string name;             // lowercase
+      const char *reply = NULL;     // static text sent before the handler runs, or NULL
+      size_t reply_len = 0;
+      Handler handler = NULL;
+   };
+
+   CommandTable() {};
+
+   // Adds a command, or replaces one with the same name. reply must live for the whole
+   // program (a literal or constant array).
+   void add(const char *name, const char *reply, Handler handler = NULL);
+   void add(const char *name, const char *reply, size_t reply_len, Handler handler = NULL);
+
+   // The command matching name (any case), NULL if there is none
+   const Command *find(std::string_view name) const;
+
+   size_t size() const { return _commands.size(); };
+
+private:
+   static uint32_t hashName(std::string_view name, uint32_t seed);
+   void rebuild();
+
+   std::vector<Command> _commands;
+   std::vector<int> _slots;         // index into _commands, -1 for an empty slot
+   uint32_t _seed = 0;
+   uint32_t _mask = 0;
+   size_t _max_len = 0;             // longer input can't be a command
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <memory>
+#include "TCPConn.h"
+
+/****************************************************************************************
+ * ConnPool - Slab allocator and connection table for one worker's TCPConns. Slots are
+ *            carved from slabs of slab_conns connections that are never returned while
+ *            the pool lives, so under churn a connection reuses a slot (and the memory of
+ *            its buffers, which are inline) instead of going back to the allocator. Freed
+ *            slots are reused last-in first-out, so a new connection lands in memory that
+ *            is still in cache.
+ *
+ *            Connections are addressed by ConnHandle: the slot index plus the slot's
+ *            generation, which changes every time the slot is created or freed. A handle
+ *            kept past its connection's release (in an epoll registration or a task
+ *            posted from another thread) just fails to look up, even once the slot holds
+ *            a new connection. The small per-slot records (generation, position) are kept
+ *            apart from the connections, and the slots in use are kept packed in one
+ *            array, so lookups and walks over the table never touch free slots.
+ *
+ *            Not thread safe--each worker keeps its own pool and only its loop uses it.
+ *
+ ****************************************************************************************/
+
+class ConnPool
+{
+public:
+   ConnPool();
+   ~ConnPool();
+
+   // Constructs a connection in a free slot, adding a slab if there are none
+   TCPConn *create(int fd, const sockaddr_in &peer, LogSvr *logSvr, PasswdMgr *pwdMgr,
+                                                                    HashPool *hashPool);
+
+   // Destroys a connection and frees its slot
+   void release(TCPConn *conn);
+
+   // The connection a handle refers to, NULL if it has since been released
+   TCPConn *lookup(ConnHandle handle) {
+      uint32_t idx = (uint32_t) handle;
+      if ((idx >= _slots.size()) || (_slots[idx].gen != (uint32_t) (handle >> 32)) ||
+          !live(idx))
+         return NULL;
+      return slotConn(idx);
+   };
+
+   // Slot indexes of the live connections, packed in no particular order
+   const std::vector<uint32_t> &active() { return _active; };
+
+   uint32_t capacity() { return (uint32_t) _slots.size(); };
+   size_t size() { return _active.size(); };
+
+private:
+   static const unsigned int slab_conns = 64;
+
+   struct Slot {
+      alignas(TCPConn) unsigned char mem[sizeof(TCPConn)];
+   };
+
+   struct SlotInfo {
+      uint32_t gen = 0;       // odd while the slot holds a connection
+      uint32_t pos = 0;       // where the slot is in _active while live
+   };
+
+   TCPConn *slotConn(uint32_t idx) {
+      return reinterpret_cast<TCPConn *>(_slabs[idx / slab_conns][idx % slab_conns].mem);
+   };
+   bool live(uint32_t idx) { return (_slots[idx].gen & 1) != 0; };
+   void addSlab();
+
+   std::vector<std::unique_ptr<Slot[]>> _slabs;
+   std::vector<SlotInfo> _slots;
+   std::vector<uint32_t> _free;     // free slot indexes, most recently freed last
+   std::vector<uint32_t> _active;
+};
+
+#endif
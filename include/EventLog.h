@@ -0,0 +1,65 @@
+#ifndef EVENTLOG_H
+#define EVENTLOG_H
+
+#include <stdint.h>
+
+/****************************************************************************************
+ * Binary event log format, written by LogSvr and read by logdump. The file is a flat
+ * array of fixed 48-byte records in host byte order, so it can be mapped and walked (or
+ * split for parallel processing) without parsing:
+ *
+ *    rec_session - written each time the server opens the log. Carries the magic and
+ *                  format version. User ids are only valid until the next session.
+ *    rec_name    - defines a user id. Written the first time a name is seen in a session,
+ *                  always before any event that uses the id.
+ *    rec_event   - one event with its outcome, time in ns, peer address and user id
+ *
+ ****************************************************************************************/
+
+const char evlog_magic[4] = {'E', 'V', 'L', 'G'};
+const uint32_t evlog_version = 1;
+const unsigned int evlog_namelen = 32;
+
+// User id for events with no user attached
+const uint32_t evlog_nouser = 0;
+
+enum evlog_kind : uint8_t { rec_session = 1, rec_name, rec_event };
+
+enum evlog_event : uint8_t {
+   ev_start = 1,     // server started
+   ev_connect,       // connection accepted, or value = connections rejected by the whitelist
+   ev_username,      // username entered
+   ev_auth,          // password checked
+   ev_passwd,        // password changed
+   ev_disconnect,    // connection closed
+   ev_dropped,       // value = log events dropped because the writer fell behind
+   ev_timeout,       // connection dropped for sitting too long in one state
+   ev_max
+};
+
+enum evlog_outcome : uint8_t { out_ok = 0, out_fail, out_rejected, out_max };
+
+struct EvRecord {
+   uint8_t kind;
+   uint8_t event;
+   uint8_t outcome;
+   uint8_t family;      // 0 no address, 4 IPv4, 6 IPv6
+   uint32_t user_id;
+   uint64_t ts_ns;      // ns since the epoch
+
+   union {
+      struct {
+         uint64_t value;      // event specific
+         uint8_t addr[16];    // IPv4 addresses use the first 4 bytes
+      } ev;
+      char name[evlog_namelen];   // rec_name, NUL padded
+      struct {
+         char magic[4];
+         uint32_t version;
+      } session;
+   };
+};
+
+static_assert(sizeof(EvRecord) == 48, "event log records must stay 48 bytes");
+
+#endif
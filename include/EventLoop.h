@@ -0,0 +1,46 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <sys/epoll.h>
+#include <stdint.h>
+#include <vector>
+#include "exceptions.h"
+
+/****************************************************************************************
+ * EventLoop - Thin wrapper around an epoll instance. FDs are registered with a pointer
+ *             to the object that owns them, which is handed back when the FD becomes ready
+ *             so the caller can dispatch directly without searching for the connection.
+ *             FDs can be registered with a 64-bit tag instead, for callers that address
+ *             their objects by handle.
+ *
+ ****************************************************************************************/
+
+class EventLoop {
+public:
+   EventLoop(unsigned int max_events = 256);
+   ~EventLoop();
+
+   // Register, change or remove an FD from the interest list
+   void addFD(int fd, uint32_t events, void *data);
+   void modFD(int fd, uint32_t events, void *data);
+   void addFD(int fd, uint32_t events, uint64_t tag);
+   void modFD(int fd, uint32_t events, uint64_t tag);
+   void delFD(int fd);
+
+   // Blocks until FDs are ready or the timeout (ms, -1 forever) expires, returns the count
+   int waitEvents(int ms_timeout = -1);
+
+   // Accessors for the results of the last waitEvents call
+   void *getData(int i) { return _events[i].data.ptr; };
+   uint64_t getTag(int i) { return _events[i].data.u64; };
+   uint32_t getEvents(int i) { return _events[i].events; };
+
+private:
+   void ctlFD(int op, int fd, uint32_t events, epoll_data_t data);
+
+   int _epfd;
+
+   std::vector<epoll_event> _events;
+};
+
+#endif
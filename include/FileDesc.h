@@ -3,6 +3,7 @@
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <vector>
 #include <unistd.h>
@@ -30,9 +31,18 @@ public:
    ssize_t writeFD(const char *data);
    ssize_t writeFD(const char *data, unsigned int len);
 
+   // Gathers several buffers into a single write
+   ssize_t writevFD(const struct iovec *iov, int iovcnt);
+
    // Basic read function to read all string data off the FD
    ssize_t readFD(std::string &buf);
 
+   // Reads straight into caller-owned storage, no copies or allocations
+   ssize_t readFD(char *buf, size_t len);
+
+   // Reads everything up to end of file in large chunks (binary safe)
+   ssize_t readAll(std::string &buf);
+
    // Reads one character from the buffer at a time until it finds a newline
    ssize_t readStr(std::string &buf);
 
@@ -141,14 +151,22 @@ protected:
 class SocketFD : public FileDesc {
 public:
    SocketFD();
+   SocketFD(int fd, const sockaddr_in &addr);
    ~SocketFD();
 
+   // Lets several sockets bind the same address and port, must come before bindFD
+   void setReusePort();
+
    void bindFD(const char *ip_addr, unsigned short int port);
    bool connectTo(const char *ip_addr, unsigned short port);
    void listenFD(int backlog = 5);
    bool acceptFD(SocketFD &server);
 
+   // Accepts a connection as a bare non-blocking FD, -1 if none was waiting (errno is set)
+   int acceptRaw(sockaddr_in &addr);
+
    unsigned long getIPAddr();
+   const sockaddr *getSockAddr() { return (const sockaddr *) &_fd_addr; };
    void getIPAddrStr(std::string &buf);
    unsigned short getPort();
 
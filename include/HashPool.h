@@ -0,0 +1,49 @@
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/****************************************************************************************
+ * HashPool - A fixed set of threads that run password hashing jobs off the network
+ *            threads. Each thread runs one job at a time, so the thread count is also the
+ *            cap on how many memory-hard hashes can be in flight at once. Jobs beyond that
+ *            wait in the queue. The number running at once can be lowered below the
+ *            thread count (setLimit) when the hashes get more memory-hungry.
+ *
+ ****************************************************************************************/
+
+class HashPool
+{
+public:
+   HashPool(unsigned int num_threads);
+   ~HashPool();
+
+   // Queues a job to run on one of the pool threads
+   void submit(std::function<void()> job);
+
+   // Runs no more than max_running jobs at once (1 up to the thread count)
+   void setLimit(unsigned int max_running);
+
+   // Threads that keep peak hashing memory under mem_cap, no more than one per core
+   static unsigned int threadsForCap(size_t mem_cap, size_t hash_mem);
+
+private:
+   void runJobs();
+
+   std::mutex _mutex;
+   std::condition_variable _cond;
+   std::deque<std::function<void()>> _jobs;
+   bool _stopping = false;
+   unsigned int _limit = 0;         // jobs allowed to run at once
+   unsigned int _running = 0;
+
+   std::vector<std::thread> _threads;
+};
+
+#endif
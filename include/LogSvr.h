@@ -9,16 +9,76 @@
 #include <sstream>
 #include <fstream>
 #include <chrono>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <sys/socket.h>
+#include "MPSCRing.h"
+#include "EventLog.h"
 
+// Events are logged as binary EventLog records (decode them with logdump). They are queued
+// without blocking and written by a background thread in batches with one write. Usernames
+// are turned into ids by the writer, so producers only copy a few bytes. The fsync policy
+// decides when the writer syncs the file:
+//    sync_never - leave it to the page cache
+//    sync_batch - fdatasync after every batch
+//    sync_interval - fdatasync at most every sync_ms milliseconds
 class LogSvr {
     public:
-        LogSvr(const char* logname);
+        enum fsync_policy {sync_never, sync_batch, sync_interval};
+
+        LogSvr(const char* logname, fsync_policy policy = sync_never, unsigned int sync_ms = 1000);
         ~LogSvr();
-        void logString(std::string log);
-        std::string CurrentDate();
+
+        // Changes the fsync policy; the writer applies it from its next batch
+        void setSyncPolicy(fsync_policy policy, unsigned int sync_ms);
+        void logEvent(evlog_event event, evlog_outcome outcome, const sockaddr *peer = NULL,
+                      const char *username = NULL, uint64_t value = 0);
+
+        // Counts a connection turned away by the whitelist. Rejections are written as one
+        // ev_connect/out_rejected record per interval with the count in value, so a flood
+        // or scan costs an atomic add per attempt instead of a log record.
+        void logRejected() { rejected.fetch_add(1, std::memory_order_relaxed); };
 
     private:
-        std::ofstream logfile;
+        struct LogEntry {
+            int64_t ts_ns;
+            uint64_t value;
+            uint8_t event;
+            uint8_t outcome;
+            uint8_t family;
+            uint8_t namelen;
+            uint8_t addr[16];
+            char name[evlog_namelen];
+        };
+
+        void writeLoop();
+        size_t writeBatch();
+        uint32_t userId(const char *name, size_t len, std::vector<EvRecord> &out);
+        void writeRecords(const std::vector<EvRecord> &out);
+
+        int logfd;
         std::string logLocation;
 
-};
\ No newline at end of file
+        std::atomic<fsync_policy> syncPolicy;
+        std::atomic<int64_t> syncIntervalNs;
+        int64_t lastSyncNs = 0;
+
+        MPSCRing<LogEntry> ring;
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<uint64_t> rejected{0};
+        int64_t lastRejectNs = 0;
+
+        // The writer only sleeps when the ring is empty, producers only notify then
+        std::thread writer;
+        std::mutex idleMutex;
+        std::condition_variable idleCond;
+        std::atomic<bool> writerIdle{false};
+        std::atomic<bool> stopping{false};
+
+        // Writer thread only: ids given to usernames so far in this session
+        std::unordered_map<std::string, uint32_t> userIds;
+        std::vector<EvRecord> batchRecs;
+};
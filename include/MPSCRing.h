@@ -0,0 +1,106 @@
+#ifndef MPSCRING_H
+#define MPSCRING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+
+/****************************************************************************************
+ * MPSCRing - Bounded lock-free ring buffer for many producers and a single consumer.
+ *            Each slot carries a sequence number: producers claim a position with a CAS
+ *            on the head and publish the slot by bumping its sequence, so they never wait
+ *            on each other or on the consumer. When the ring is full, tryPush fails
+ *            rather than blocking. The consumer can peek several published slots in
+ *            order and release them together once it is done with them.
+ *
+ ****************************************************************************************/
+
+template <typename T>
+class MPSCRing
+{
+public:
+   // capacity is rounded up to a power of two
+   MPSCRing(size_t capacity) {
+      size_t size = 2;
+      while (size < capacity)
+         size <<= 1;
+
+      _mask = size - 1;
+      _slots = std::vector<Slot>(size);
+      for (size_t i = 0; i < size; i++)
+         _slots[i].seq.store(i, std::memory_order_relaxed);
+   }
+
+   /*************************************************************************************
+    * tryPush - claims a slot, lets fill() write the item in place and publishes it
+    *
+    *    Params:  fill - callable taking a T& to populate
+    *
+    *    Returns: false if the ring was full and nothing was written
+    *************************************************************************************/
+
+   template <typename F>
+   bool tryPush(F fill) {
+      size_t pos = _head.load(std::memory_order_relaxed);
+      Slot *slot;
+
+      while (true) {
+         slot = &_slots[pos & _mask];
+         size_t seq = slot->seq.load(std::memory_order_acquire);
+         intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+
+         if (diff == 0) {
+            if (_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+               break;
+         } else if (diff < 0) {
+            return false;
+         } else {
+            pos = _head.load(std::memory_order_relaxed);
+         }
+      }
+
+      fill(slot->item);
+      slot->seq.store(pos + 1, std::memory_order_release);
+      return true;
+   }
+
+   /*************************************************************************************
+    * peek - consumer only. Returns the nth published item after the tail, or NULL if
+    *        it hasn't been published yet. Items stay valid until release().
+    *************************************************************************************/
+
+   T *peek(size_t n) {
+      size_t pos = _tail + n;
+      Slot &slot = _slots[pos & _mask];
+      if (slot.seq.load(std::memory_order_acquire) != pos + 1)
+         return NULL;
+      return &slot.item;
+   }
+
+   // Consumer only. Hands the first n peeked slots back to the producers.
+   void release(size_t n) {
+      for (size_t i = 0; i < n; i++) {
+         Slot &slot = _slots[(_tail + i) & _mask];
+         slot.seq.store(_tail + i + _mask + 1, std::memory_order_release);
+      }
+      _tail += n;
+   }
+
+   size_t capacity() { return _mask + 1; };
+
+private:
+   struct Slot {
+      std::atomic<size_t> seq;
+      T item;
+   };
+
+   std::vector<Slot> _slots;
+   size_t _mask;
+
+   // Producers contend on the head, the consumer owns the tail--keep them on separate lines
+   alignas(64) std::atomic<size_t> _head{0};
+   alignas(64) size_t _tail = 0;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+
+/****************************************************************************************
+ * Metrics - Process-wide counters and latency histograms for the server's hot paths.
+ *
+ *           Every thread that records gets its own block of counters, registered the
+ *           first time it records and never freed, so recording is a thread-local
+ *           load and store with no lock and no shared cache line. Readers sum the
+ *           blocks, which may be a few events behind but never torn.
+ *
+ *           Histograms are log-linear in the style of HDR histograms: 8 buckets per
+ *           power of two of nanoseconds, so any value is placed within 12.5% up to
+ *           about 9 minutes. Recording is off (and costs one relaxed load) until
+ *           setEnabled is called.
+ *
+ ****************************************************************************************/
+
+class Metrics
+{
+public:
+   // Timed stages, in the order they are reported
+   enum stage_type { stage_accept, stage_whitelist, stage_user_lookup, stage_argon2,
+                     stage_dispatch, stage_flush, num_stages };
+
+   enum counter_type { ctr_accepted, ctr_rejected, ctr_closed, ctr_logins_ok, ctr_logins_failed,
+                       ctr_auth_cache_hits, ctr_commands, num_counters };
+
+   static void setEnabled(bool enabled) { _enabled.store(enabled, std::memory_order_relaxed); };
+   static bool enabled() { return _enabled.load(std::memory_order_relaxed); };
+
+   static void count(counter_type counter, uint64_t n = 1);
+   static void record(stage_type stage, uint64_t ns);
+
+   // Steady clock ns for timing a stage, 0 while recording is off
+   static int64_t startTime();
+
+   // Appends every metric in the Prometheus text exposition format
+   static void render(std::string &out);
+
+   // Records the time from construction to destruction against a stage
+   class Timer {
+   public:
+      Timer(stage_type stage):_stage(stage), _start(startTime()) {};
+      ~Timer() { if (_start != 0) record(_stage, startTime() - _start); };
+
+   private:
+      stage_type _stage;
+      int64_t _start;
+   };
+
+   static const unsigned int sub_bits = 3;
+   static const unsigned int sub_count = 1 << sub_bits;
+   static const unsigned int max_exp = 39;     // 2^39 ns, about 9 minutes
+   static const unsigned int num_buckets = (max_exp - sub_bits + 2) * sub_count;
+
+   static unsigned int bucketFor(uint64_t ns);
+   static uint64_t bucketLow(unsigned int bucket);
+
+   // One thread's counters, defined in Metrics.cpp
+   struct Block;
+
+private:
+   static Block &threadBlock();
+
+   static std::atomic<bool> _enabled;
+};
+
+#endif
@@ -0,0 +1,34 @@
+#ifndef METRICSSVR_H
+#define METRICSSVR_H
+
+#include <thread>
+#include "FileDesc.h"
+
+/****************************************************************************************
+ * MetricsSvr - Admin endpoint that serves the Metrics in the Prometheus text format to
+ *              any HTTP GET (or to a bare connection that sends nothing, e.g. nc). It
+ *              runs on a thread of its own with blocking I/O, one short request at a
+ *              time, so scrapes never touch the event loops. Bind it to loopback.
+ *
+ ****************************************************************************************/
+
+class MetricsSvr
+{
+public:
+   MetricsSvr();
+   ~MetricsSvr();
+
+   void bindSvr(const char *ip_addr, unsigned short port);
+
+   // Starts serving on a new thread, until the server is destroyed
+   void start();
+
+private:
+   void serveLoop();
+   void serveClient(int fd);
+
+   SocketFD _sockfd;
+   std::thread _thread;
+};
+
+#endif
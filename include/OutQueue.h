@@ -0,0 +1,69 @@
+#ifndef OUTQUEUE_H
+#define OUTQUEUE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <string>
+#include "FileDesc.h"
+
+// Bytes a connection may have queued before it stops handling input, and the point past
+// which a client that still isn't reading is dropped
+const size_t out_queue_limit = 64 * 1024;
+const size_t out_queue_hard_limit = 4 * out_queue_limit;
+
+// Fragments the queue holds inline. Past that, everything queued is coalesced into the
+// last chunk.
+const unsigned int out_max_frags = 32;
+
+/****************************************************************************************
+ * OutQueue - Per-connection output queue. Replies are queued as fragments and written
+ *            together with writev, so a response made of several pieces goes out in one
+ *            syscall (and usually one segment). Constant text is queued by pointer; other
+ *            text is copied into chunks that small replies are coalesced into. Whatever the
+ *            socket doesn't take stays queued until it is writable again.
+ *
+ *            Fragments live in a fixed ring inside the queue, so an empty queue owns no
+ *            heap memory and only copied text (rare--nearly every reply is constant)
+ *            allocates.
+ *
+ ****************************************************************************************/
+
+class OutQueue
+{
+public:
+   OutQueue() {};
+
+   // Queues data that outlives the queue (string literals, constant tables) without a copy
+   bool pushStatic(const char *data, size_t len);
+
+   // Queues a copy of data
+   bool pushCopy(const char *data, size_t len);
+
+   // Writes as much as the FD will take. False on a write error other than EAGAIN.
+   bool flush(FileDesc &fd);
+
+   void clear();
+
+   bool empty() { return _bytes == 0; };
+   size_t size() { return _bytes; };
+
+private:
+   struct Fragment {
+      const char *data;       // NULL for a copied chunk, which lives in buf
+      size_t len;
+      std::string buf;
+   };
+
+   bool reserve(size_t len);
+   Fragment &frag(unsigned int i) { return _frags[(_head + i) % out_max_frags]; };
+   Fragment &back() { return frag(_nfrags - 1); };
+   void popFront();
+
+   Fragment _frags[out_max_frags];
+   unsigned int _head = 0;    // ring index of the first fragment
+   unsigned int _nfrags = 0;
+   size_t _front_off = 0;     // bytes of the first fragment already written
+   size_t _bytes = 0;         // bytes queued and not yet written
+};
+
+#endif
@@ -0,0 +1,133 @@
+#ifndef PASSWDDB_H
+#define PASSWDDB_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include "exceptions.h"
+
+/****************************************************************************************
+ * PasswdDB - Binary password file that is mmap'ed and searched in place. Layout is:
+ *
+ *    header  - magic "PWDB", version, record count, index size, section offsets and the
+ *              largest m_cost of any record (version 2)
+ *    records - fixed-size {name[32], hash[32], salt[16], argon2 parameters}, name NUL
+ *              padded. Version 1 files have no parameters (they are all legacy_params)
+ *              and are still read; writes always produce version 2.
+ *    index   - open-addressed hash table of uint32 record number + 1 (0 = empty slot),
+ *              probed linearly from FNV-1a(name)
+ *
+ * Opening the file and looking a user up are constant time--nothing is parsed. All
+ * integers are stored in host byte order.
+ *
+ ****************************************************************************************/
+
+const unsigned int pwdb_namelen = 32;
+const unsigned int pwdb_hashlen = 32;
+const unsigned int pwdb_saltlen = 16;
+
+/****************************************************************************************
+ * HashParams - argon2 variant and costs a password hash was made with
+ ****************************************************************************************/
+
+struct HashParams {
+   // Same values as libargon2's argon2_type
+   enum variant_type : uint8_t { argon2d = 0, argon2i = 1, argon2id = 2 };
+
+   uint8_t variant = argon2i;
+   uint32_t t_cost = 2;          // passes
+   uint32_t m_cost = (1 << 16);  // KiB
+   uint32_t lanes = 1;           // parallelism
+
+   bool operator==(const HashParams &other) const {
+      return (variant == other.variant) && (t_cost == other.t_cost) &&
+             (m_cost == other.m_cost) && (lanes == other.lanes);
+   };
+   bool operator!=(const HashParams &other) const { return !(*this == other); };
+};
+
+// What every hash was made with before parameters were stored
+const HashParams legacy_params;
+
+class PasswdDB
+{
+public:
+   struct Entry {
+      std::string name;
+      std::vector<uint8_t> hash;
+      std::vector<uint8_t> salt;
+      HashParams params;
+   };
+
+   PasswdDB();
+   ~PasswdDB();
+
+   PasswdDB(const PasswdDB &) = delete;
+   PasswdDB &operator=(const PasswdDB &) = delete;
+
+   // Maps the file, false if it isn't in the binary format (throws if it is but is corrupt)
+   bool openDB(const char *filename);
+   bool isOpen() const { return (_map != NULL); };
+   void closeDB();
+
+   // Record number of the user, or -1 if not found
+   long findRecord(const char *name) const;
+   bool findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt,
+                                                               HashParams &params) const;
+
+   // Record access for rewriting the file
+   size_t numUsers() const;
+
+   // Largest m_cost of any record's hash params, 0 if there are no records. Read from
+   // the header, so it doesn't touch the records.
+   uint32_t maxMemCost() const;
+   void getEntry(size_t recnum, Entry &entry) const;
+
+   // Writes a complete binary password file from the given users
+   static void writeDB(const char *filename, const std::vector<Entry> &users);
+
+   // Atomically replaces a file with data (temp file, fsync, rename, directory fsync)
+   static void replaceFile(const char *filename, const std::string &data);
+
+private:
+   struct Header {
+      char magic[4];
+      uint32_t version;
+      uint32_t num_records;
+      uint32_t record_size;
+      uint32_t index_slots;
+      uint32_t max_m_cost;       // KiB, reserved in version 1
+      uint64_t records_off;
+      uint64_t index_off;
+      uint8_t pad[24];
+   };
+
+   // Version 2 record. Version 1 records end after salt.
+   struct Record {
+      char name[pwdb_namelen];
+      uint8_t hash[pwdb_hashlen];
+      uint8_t salt[pwdb_saltlen];
+      uint32_t m_cost;
+      uint16_t t_cost;
+      uint8_t lanes;
+      uint8_t variant;
+   };
+
+   const Record &record(size_t recnum) const {
+      return *(const Record *) (_records + recnum * _header->record_size);
+   };
+   void getParams(const Record &rec, HashParams &params) const;
+
+   static uint64_t hashName(const char *name, size_t len);
+   static uint32_t indexSlots(size_t num_records);
+
+   const uint8_t *_map = NULL;
+   size_t _maplen = 0;
+
+   const Header *_header = NULL;
+   const uint8_t *_records = NULL;
+   const uint32_t *_index = NULL;
+};
+
+#endif
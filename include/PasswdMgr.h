@@ -3,10 +3,35 @@
 
 #include <string>
 #include <stdexcept>
+#include <functional>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <sys/stat.h>
 #include "FileDesc.h"
+#include "HashPool.h"
+#include "PasswdDB.h"
+#include "AuthCache.h"
 
 /****************************************************************************************
- * PasswdMgr - Manages user authentication through a file
+ * PasswdMgr - Manages user authentication through a file. The file is loaded once into a
+ *             hash-indexed table that is shared by every connection and reloaded when the
+ *             file changes on disk, so lookups never touch the file. Files in the binary
+ *             PasswdDB format are mapped and searched in place instead of being loaded.
+ *
+ *             Every change (new users, new passwords, conversion) rewrites the whole file
+ *             copy-on-write: the current file is re-read under an exclusive flock on
+ *             "<file>.lock", the changes are applied, and the result replaces the file by
+ *             rename. Other processes (my_adduser) take the same lock, so no update is
+ *             lost, and readers and crashes only ever see a complete file. Changes that
+ *             arrive while a rewrite is running are group committed by the next one.
+ *
+ *             Each user's hash records the argon2 variant and costs it was made with, so
+ *             the costs can be raised (setHashParams) without invalidating anyone: records
+ *             are verified with their own parameters, and a successful login whose record
+ *             is out of date rehashes the password with the current ones.
  *
  ****************************************************************************************/
 
@@ -17,22 +42,129 @@ class PasswdMgr {
 
       bool checkUser(const char *name);
       bool checkPasswd(const char *name, const char *passwd);
+
+      // Runs checkPasswd on the hash pool and calls done with the result from a pool thread
+      void checkPasswdAsync(const char *name, const char *passwd, HashPool &pool,
+                                                         std::function<void(bool)> done);
+      // False if the user doesn't exist
       bool changePasswd(const char *name, const char *newpassd);
+
+      // Runs changePasswd on the hash pool and calls done with the result from a pool thread
+      void changePasswdAsync(const char *name, const char *newpasswd, HashPool &pool,
+                                                         std::function<void(bool)> done);
    
+      // Throws pwfile_error if the user already exists
       void addUser(const char *name, const char *passwd);
 
-      void hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt, const char *passwd, 
-                                                                                 std::vector<uint8_t> *in_salt = NULL);
+      // A user for importUsers: a password to hash, or an entry that was hashed elsewhere
+      struct NewUser {
+         PasswdDB::Entry entry;     // name, plus hash, salt and params if already hashed
+         std::string passwd;        // hashed with the current parameters if entry.hash is empty
+      };
+
+      // Adds many users with one file rewrite, hashing their passwords on the pool. Names
+      // listed twice or already in the file are skipped and put in skipped. Returns the
+      // number added.
+      size_t importUsers(std::vector<NewUser> &users, HashPool &pool,
+                                                      std::vector<std::string> &skipped);
+
+      // Remembers successful checks for ttl_secs so repeat logins skip the hash (off by
+      // default). Set before any checks run.
+      void setAuthCache(unsigned int ttl_secs, size_t max_entries);
+
+      // Rewrites a legacy text password file in the binary PasswdDB format
+      void convertToBinary();
+
+      // Parameters new hashes are made with (legacy_params by default). Set before any
+      // checks run. Text files can only hold legacy hashes, so the first other hash
+      // stored converts the file to the binary format.
+      void setHashParams(const HashParams &params);
+      const HashParams &getHashParams() const { return _params; };
+
+      // Parses "<variant>:<t_cost>:<m_cost KiB>:<lanes>", variant one of i, d or id and
+      // lanes 0 for one per core. False if the spec is malformed or out of range.
+      static bool parseHashParams(const char *spec, HashParams &params);
+
+      // Bytes of memory the costliest hash we may run allocates: the larger of the current
+      // parameters and the biggest m_cost in the loaded table
+      size_t hashMemBytes() const;
+
+      // Rebuilds the table on the pool when the file changes, rather than on the thread
+      // that noticed, and keeps the number of hashes the pool runs at once under mem_cap
+      // for hashMemBytes, adjusted on every reload
+      void useHashPool(HashPool &pool, size_t mem_cap);
 
    private:
-      bool findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
-      bool readUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
-      int writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt);
-      void generateSalt(std::vector<uint8_t> &size);
-      uint8_t genRandom();
+      struct UserRec {
+         std::vector<uint8_t> hash;
+         std::vector<uint8_t> salt;
+         HashParams params;
+      };
+      struct UserTable {
+         std::unordered_map<std::string, UserRec> users;   // legacy text format
+         PasswdDB db;                                      // binary format, mapped
+      };
+
+      // A change waiting for the next group commit
+      struct Update {
+         PasswdDB::Entry entry;
+         bool add;                  // new user, otherwise a new password for an existing one
+         std::vector<uint8_t> old_hash;   // if set, only replace a password still hashed to this
+         bool done = false;
+         bool result = false;
+         std::string error;         // set if the commit failed
+      };
+
+      bool findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt,
+                                                                  HashParams &params);
+      void hashArgon2(std::vector<uint8_t> &ret_hash, const std::vector<uint8_t> &salt,
+                                          const char *passwd, const HashParams &params);
+      void rehashUser(const char *name, const char *passwd, const std::vector<uint8_t> &old_hash);
+      std::shared_ptr<const UserTable> getTable();
+      void refreshTable(int64_t now);
+      void reloadTable(bool force);
+      void publishTable(std::shared_ptr<UserTable> table, const struct stat &st);
+      void parseUsers(const std::string &data, std::vector<PasswdDB::Entry> &entries);
+      void tableWritten();
+
+      bool commitUpdate(Update &update);
+      void commitBatch(std::vector<Update *> &batch);
+      bool loadEntries(std::vector<PasswdDB::Entry> &entries);
+      void storeEntries(const std::vector<PasswdDB::Entry> &entries, bool binary);
+      void generateSalt(std::vector<uint8_t> &salt);
 
       std::string _pwd_file;
       std::string out_text;
+
+      // Current table, swapped whole on reload so readers never see a partial one
+      std::shared_ptr<const UserTable> _users;
+
+      // Guards reload checks and the file identity the current table was loaded from
+      std::mutex _reload_mutex;
+      struct stat _loaded_stat;
+      std::atomic<int64_t> _next_check;
+      bool _reload_queued = false;
+
+      // Held while a table is built and published, so reloads never publish out of order
+      std::mutex _load_mutex;
+
+      // What new hashes are made with
+      HashParams _params;
+
+      // Largest m_cost (KiB) of any user in the current table, and the pool reloads run on,
+      // kept under a memory cap for it (guarded by _reload_mutex)
+      std::atomic<uint32_t> _table_m_cost;
+      HashPool *_pool = NULL;
+      size_t _pool_mem_cap = 0;
+
+      // Recent successful checks, NULL when caching is off
+      std::unique_ptr<AuthCache> _auth_cache;
+
+      // Changes queued for the next commit, and whether a thread is committing now
+      std::mutex _commit_mutex;
+      std::condition_variable _commit_cv;
+      std::vector<Update *> _commit_queue;
+      bool _committing = false;
 };
 
 #endif
@@ -0,0 +1,48 @@
+#ifndef RECVBUFFER_H
+#define RECVBUFFER_H
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <string_view>
+#include "FileDesc.h"
+
+// Longest line a client may send, including the newline
+const size_t recv_buf_size = 4096;
+
+/****************************************************************************************
+ * RecvBuffer - Fixed per-connection receive buffer. Socket data is read straight into
+ *              its storage and complete lines are handed out as string_views into it, so
+ *              the receive path never allocates or copies. Consumed space at the front is
+ *              reclaimed by sliding the (short) unconsumed tail down before the next read.
+ *
+ *              A line handed out by getLine stays valid, and NUL terminated, until the
+ *              next readFrom.
+ *
+ ****************************************************************************************/
+
+class RecvBuffer
+{
+public:
+   RecvBuffer() {};
+
+   // Reads once from fd into the free space, returns the read() result
+   ssize_t readFrom(FileDesc &fd);
+
+   // Takes the next complete line without its \r\n, false if there isn't one
+   bool getLine(std::string_view &line);
+
+   // True if a complete line is waiting
+   bool hasLine();
+
+   // True if no more can be read until lines are taken out
+   bool full() { return (_start == 0) && (_end == recv_buf_size); };
+
+private:
+   char _data[recv_buf_size];
+
+   size_t _start = 0;      // first unconsumed byte
+   size_t _end = 0;        // end of the data read so far
+   size_t _scan = 0;       // no newline in [_start, _scan), so searches resume here
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef SMALLSTR_H
+#define SMALLSTR_H
+
+#include <stddef.h>
+#include <cstring>
+#include <memory>
+#include <string_view>
+
+/****************************************************************************************
+ * SmallStr - String with N bytes of inline storage, for short per-connection values
+ *            (usernames, passwords being changed) that would otherwise each be a heap
+ *            allocation. Only a value longer than N goes to the heap. clear() zeroes the
+ *            old contents, so a password doesn't linger in a pooled connection slot.
+ *
+ ****************************************************************************************/
+
+template <size_t N>
+class SmallStr
+{
+public:
+   SmallStr() { _inline[0] = '\0'; };
+   ~SmallStr() { clear(); };
+
+   SmallStr(const SmallStr &) = delete;
+   SmallStr &operator=(const SmallStr &) = delete;
+
+   SmallStr &operator=(std::string_view str) {
+      clear();
+      if (str.size() > N) {
+         _heap.reset(new char[str.size() + 1]);
+         _data = _heap.get();
+      }
+      memcpy(_data, str.data(), str.size());
+      _data[str.size()] = '\0';
+      _len = str.size();
+      return *this;
+   }
+
+   void clear() {
+      memset(_data, 0, _len);
+      _heap.reset();
+      _data = _inline;
+      _len = 0;
+   }
+
+   const char *c_str() const { return _data; };
+   std::string_view view() const { return std::string_view(_data, _len); };
+   size_t size() const { return _len; };
+   bool empty() const { return _len == 0; };
+
+private:
+   char _inline[N + 1];
+   char *_data = _inline;
+   size_t _len = 0;
+   std::unique_ptr<char[]> _heap;
+};
+
+#endif
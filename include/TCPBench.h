@@ -0,0 +1,99 @@
+#ifndef TCPBENCH_H
+#define TCPBENCH_H
+
+#include <stdint.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include "EventLoop.h"
+
+/****************************************************************************************
+ * TCPBench - Load generator for tcpserver. Drives many non-blocking sessions from one
+ *            epoll loop, each running the login flow followed by menu commands picked from
+ *            a weighted mix, then exit. Times every stage and reports rates and latency
+ *            percentiles.
+ *
+ *            Closed loop (the default) keeps a fixed number of sessions running, starting a
+ *            new one as soon as one finishes. Open loop starts sessions at a fixed rate no
+ *            matter how the server is keeping up, and times the connect from when the
+ *            session was due, so a stalled server shows up as latency rather than as a
+ *            lower request rate.
+ *
+ ****************************************************************************************/
+
+class TCPBench
+{
+public:
+   TCPBench();
+   ~TCPBench();
+
+   void setTarget(const char *ip_addr, unsigned short port);
+   void setLogin(const char *username, const char *password);
+   void setConcurrency(unsigned int conns) { _max_conns = conns; };
+   void setRate(double sessions_per_sec) { _rate = sessions_per_sec; };
+   void setDuration(double secs) { _duration_ns = (int64_t) (secs * 1e9); };
+   void setCommands(unsigned int per_session) { _cmds_per_session = per_session; };
+   void setTimeout(double secs) { _timeout_ns = (int64_t) (secs * 1e9); };
+
+   // Weighted command mix such as "hello=4,1=1,passwd=1"
+   bool setMix(const char *mix);
+
+   void run();
+   void report();
+
+private:
+   enum benchstate { b_connect, b_username, b_passwd, b_command, b_newpwd, b_confirmpwd,
+                     b_exit, b_idle };
+
+   struct Session {
+      int fd = -1;
+      benchstate state = b_idle;
+      int64_t stage_start = 0;   // when the stage being timed started (or was due)
+      int64_t deadline = 0;
+      unsigned int cmds_left = 0;
+      int cmd = -1;              // index into _cmds of the command in flight
+      std::string inbuf;
+   };
+
+   struct Command {
+      std::string name;
+      const char *reply_end;     // the reply is complete once this arrives
+      unsigned int weight;
+   };
+
+   bool startSession(int64_t due);
+   void endSession(Session &sess, bool ok);
+   void handleSession(Session &sess, uint32_t events);
+   void nextCommand(Session &sess, int64_t now);
+   void sendLine(Session &sess, const std::string &line);
+   void expireSessions(int64_t now);
+   void record(unsigned int stage, int64_t start, int64_t now);
+
+   sockaddr_in _addr;
+   std::string _username;
+   std::string _password;
+
+   unsigned int _max_conns = 100;
+   double _rate = 0;
+   int64_t _duration_ns = 10000000000LL;
+   int64_t _timeout_ns = 10000000000LL;
+   unsigned int _cmds_per_session = 5;
+
+   std::vector<Command> _cmds;
+   unsigned int _total_weight = 0;
+
+   EventLoop _evloop;
+   std::vector<Session> _sessions;
+   std::vector<Session *> _free;
+
+   // Latency samples in ns: connect, username, auth, then one per command
+   std::vector<std::vector<uint32_t>> _samples;
+   std::vector<std::string> _stage_names;
+
+   uint64_t _started = 0, _completed = 0, _failed = 0, _skipped = 0, _connect_errors = 0;
+   uint64_t _connects = 0, _auths = 0;
+   int64_t _begin_ns = 0, _end_ns = 0;
+   uint64_t _rand_state = 0x9e3779b97f4a7c15ULL;
+};
+
+#endif
@@ -9,6 +9,18 @@
 const unsigned int stdin_bufsize = 50;
 const unsigned int socket_bufsize = 100;
 
+/****************************************************************************************
+ * TCPClient - Line-oriented client. Blocks in a single poll over stdin and the socket, so
+ *             it uses no CPU while neither has anything. Every complete line typed is
+ *             sent as soon as it arrives, and whatever the server sends is shown.
+ *
+ *             In script mode the commands come from a file instead: the whole script is
+ *             sent up front (pipelined) and the client exits once the server hangs up,
+ *             or once the server has been quiet for the idle timeout after the script
+ *             went out.
+ *
+ ****************************************************************************************/
+
 class TCPClient : public Client
 {
 public:
@@ -20,12 +32,29 @@ public:
 
    virtual void closeConn();
 
+   // Sends the commands in a file instead of reading stdin
+   void setScript(const char *filename);
+
+   // Seconds to wait for more from the server once a script has been sent
+   void setIdleTimeout(unsigned int secs) { _idle_ms = secs * 1000; };
+
 private:
-   int readStdin();
+   void loadScript();
+   void readStdin();
+   bool readSocket();
+   void flushOutput();
 
-   // Stores the user's typing
+   // Stores the user's typing until a line is complete
    std::string _in_buf;
 
+   // Data waiting to go to the server, of which _out_off bytes have been sent
+   std::string _out_buf;
+   size_t _out_off = 0;
+
+   std::string _script_file;
+   int _idle_ms = 5000;
+   bool _stdin_open = true;
+
    // Class to manage our client's network connection
    SocketFD _sockfd;
  
@@ -1,45 +1,103 @@
 #ifndef TCPCONN_H
 #define TCPCONN_H
 
+#include <string_view>
 #include "FileDesc.h"
+#include "RecvBuffer.h"
+#include "OutQueue.h"
+#include "SmallStr.h"
+#include "CommandTable.h"
+#include "TimingWheel.h"
 #include "LogSvr.h"
 #include "PasswdMgr.h"
+#include "HashPool.h"
 
 const int max_attempts = 2;
 
+// Seconds a connection may wait at each phase of login, and sit idle once logged in,
+// before it is dropped (0 = never)
+struct ConnTimeouts {
+   unsigned int username = 30;
+   unsigned int passwd = 30;
+   unsigned int idle = 900;
+};
+
+class TCPWorker;
+
+// Refers to a connection in its worker's ConnPool: generation << 32 | slot index
+typedef uint64_t ConnHandle;
+
 // Methods and attributes to manage a network connection, including tracking the username
 // and a buffer for user input. Status tracks what "phase" of login the user is currently in
 class TCPConn 
 {
 public:
-   TCPConn(std::shared_ptr<LogSvr> inputServer);
+   // Takes over a non-blocking socket the server accepted and admitted. The log, user table
+   // and hash pool belong to the server, which outlives its connections.
+   TCPConn(int fd, const sockaddr_in &peer, LogSvr *inputServer, PasswdMgr *passwdMgr,
+                                                                 HashPool *hashPool);
    ~TCPConn();
 
-   bool accept(SocketFD &server);
-
+   // Queue replies for the next flush. sendStatic is for text that is never freed
+   // (literals and constant tables) and queues it without copying.
    int sendText(const char *msg);
    int sendText(const char *msg, int size);
+   int sendStatic(const char *msg);
+   int sendStatic(const char *msg, int size);
+
+   // Writes queued replies, watching for writability if the socket can't take them all
+   void flushOutput();
+   bool outputBlocked() { return _outq.size() > out_queue_limit; };
 
    void handleConnection();
    void startAuthentication();
    void getUsername();
    void getPasswd();
+   void finishPasswd(bool authenticated);
    void sendMenu();
    void getMenuChoice();
+
+   // Starts a password change--prompts for the new password
    void setPassword();
    void changePassword();
+   void finishChangePasswd(bool changed);
    
-   bool getUserInput(std::string &cmd);
+   bool readInput();
+   bool getUserInput(std::string_view &line);
+   bool hasPendingInput();
 
    void disconnect();
    bool isConnected();
 
+   // Commands available from the menu, shared by every connection. Add more before the
+   // server starts.
+   static CommandTable &commands();
+
+   // The worker whose loop owns this connection, used to post async results back to it
+   void setWorker(TCPWorker *worker) { _worker = worker; };
+
+   // The connection's handle in its worker's ConnPool
+   void setHandle(ConnHandle handle) { _handle = handle; };
+   ConnHandle getHandle() { return _handle; };
+
+   // Timer for the current phase, and the seconds to arm it for after a turn: -1 to leave it
+   // as is, 0 to cancel it
+   TimerNode &timer() { return _timer; };
+   int nextTimeout(const ConnTimeouts &timeouts);
+
+   // Called when the timer expires
+   void timeOut();
+
+   int getFD() { return _connfd.getFD(); };
    unsigned long getIPAddr() { return _connfd.getIPAddr(); };
+   const sockaddr *getSockAddr() { return _connfd.getSockAddr(); };
    void getIPAddrStr(std::string &buf);
    const char *getUsernameStr() { return _username.c_str(); };
 
 private:
-
+   void dispatchInput();
+   void dispatchLine();
+   void closeConn();
 
    enum statustype { s_username, s_changepwd, s_confirmpwd, s_passwd, s_menu };
 
@@ -47,17 +105,35 @@ private:
 
    SocketFD _connfd;
  
-   std::string _username; // The username this connection is associated with
+   SmallStr<32> _username; // The username this connection is associated with
+
+   RecvBuffer _inbuf;
+
+   bool _recv_stalled = false; // Stopped reading because _inbuf was full, more may be waiting
 
-   std::string _inputbuf;
+   OutQueue _outq;
 
-   std::string _newpwd; // Used to store user input for changing passwords
+   bool _watch_out = false;    // EPOLLOUT is armed because _outq couldn't be flushed
+
+   TimerNode _timer;
+   int _timed_status = -1;     // phase the timer was last armed for
+   bool _had_input = false;    // data arrived since the timer was last armed
+
+   SmallStr<64> _newpwd; // Used to store user input for changing passwords
 
    int _pwd_attempts = 0;
 
-   std::shared_ptr<LogSvr> logServer;
+   bool _auth_pending = false; // A password check or change is running on the hash pool
+
+   TCPWorker *_worker = NULL;
+   ConnHandle _handle = 0;
+
+   LogSvr *logServer;
+
+   HashPool *_hashpool;
 
-   PasswdMgr pwdMgr;
+   // Shared by every connection on the server
+   PasswdMgr *pwdMgr;
 };
 
 
@@ -9,7 +9,15 @@
 #include <vector>
 #include <iostream>
 #include "LogSvr.h"
+#include "EventLoop.h"
+#include "TCPWorker.h"
+#include "HashPool.h"
+#include "Whitelist.h"
+#include "MetricsSvr.h"
 #include <memory>
+#include <mutex>
+#include <atomic>
+#include <exception>
 
 class TCPServer : public Server 
 {
@@ -21,18 +29,91 @@ public:
    void listenSvr();
    void shutdown();
 
+   // Number of event-loop threads to run, 0 for one per core (default is single-threaded)
+   void setNumThreads(unsigned int num_threads);
+
+   // Cap in MiB on memory used by password hashes running at the same time
+   void setHashMemCap(unsigned int mem_mib);
+
+   // When the log writer syncs the event log to disk (sync_ms only for sync_interval)
+   void setLogSync(LogSvr::fsync_policy policy, unsigned int sync_ms = 1000);
+
+   // Remember successful logins for ttl_secs so repeats skip argon2 (0 = off, the default)
+   void setAuthCache(unsigned int ttl_secs, size_t max_entries);
+
+   // argon2 parameters new and rehashed passwords use (see PasswdMgr::setHashParams)
+   void setHashParams(const HashParams &params);
+
+   // Turns on metrics and serves them on 127.0.0.1:port (Prometheus text), 0 for none
+   void setMetricsPort(unsigned short port);
+
+   // Seconds a connection may spend at each login phase or idle before it is dropped
+   void setTimeouts(const ConnTimeouts &timeouts) { _timeouts = timeouts; };
+   const ConnTimeouts &getTimeouts() { return _timeouts; };
+
+   // Connections the kernel queues for accept (default SOMAXCONN)
+   void setBacklog(int backlog);
+
+   // One SO_REUSEPORT listener per worker in multi-threaded mode, set before bindSvr
+   void setReusePort(bool reuseport);
+
+   // Accepts everything waiting on a listener, for owner or for the least-loaded worker
+   void acceptConns(SocketFD &listener, TCPWorker *owner = NULL);
+
+   // Called by a worker whose loop died on an error: stops the server, and listenSvr
+   // rethrows the first such error once every worker has stopped. Safe from any thread.
+   void fail(std::exception_ptr error);
+
+   // Shared state the workers build their connections with
+   LogSvr *getLogSvr() { return logServer.get(); };
+   PasswdMgr *getPasswdMgr() { return pwdMgr.get(); };
+   HashPool *getHashPool() { return hashPool.get(); };
+
 private:
+   TCPWorker *pickWorker();
+   void stopWorkers();
+
    // Class to manage the server socket
    SocketFD _sockfd;
+   std::string _bind_ip;
+   unsigned short _bind_port = 0;
+   int _backlog = SOMAXCONN;
+
+   // Extra listeners for the other workers when sharding with SO_REUSEPORT
+   bool _reuseport = false;
+   std::vector<std::unique_ptr<SocketFD>> _listeners;
+
+   // epoll instance the acceptor waits on in multi-threaded mode
+   EventLoop _evloop;
+
+   // eventfd that wakes the thread running listenSvr when a worker fails, and the error
+   int _stopfd = -1;
+   std::mutex _fail_mutex;
+   std::exception_ptr _failure;
  
-   // List of TCPConn objects to manage connections
-   std::list<std::unique_ptr<TCPConn>> _connlist;
+   // Event loops that own the connections
+   std::vector<std::unique_ptr<TCPWorker>> _workers;
+   unsigned int _num_threads = 0;
+   unsigned int _next_worker = 0;
+
+   ConnTimeouts _timeouts;
+
+   // Threads that run argon2 checks off the event loops
+   std::shared_ptr<HashPool> hashPool;
+   size_t _hash_mem_cap = 256 * 1024 * 1024;
 
     
-   //Array of White-List IPs stored as strings?
-   std::vector<std::string> whiteList;
+   // Addresses allowed to connect, checked on every accept
+   std::shared_ptr<Whitelist> whiteList;
    std::shared_ptr<LogSvr> logServer;
 
+   // One user table for the whole server
+   std::shared_ptr<PasswdMgr> pwdMgr;
+
+   // Admin endpoint for the metrics, when enabled
+   std::unique_ptr<MetricsSvr> _metrics_svr;
+   unsigned short _metrics_port = 0;
+
 };
 
 
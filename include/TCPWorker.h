@@ -0,0 +1,111 @@
+#ifndef TCPWORKER_H
+#define TCPWORKER_H
+
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include "FileDesc.h"
+#include "TCPConn.h"
+#include "ConnPool.h"
+#include "EventLoop.h"
+#include "TimingWheel.h"
+
+class TCPServer;
+
+/****************************************************************************************
+ * TCPWorker - An event loop with its own epoll instance and its own set of connections.
+ *             In single-threaded mode the server runs one worker on the calling thread and
+ *             lets it watch the server socket as well. In multi-threaded mode each worker
+ *             runs on its own thread and accepted sockets are handed to it through a
+ *             small locked inbox, with an eventfd to wake the loop. The worker builds the
+ *             connection state in its own ConnPool, so it is allocated and freed on the
+ *             thread that uses it. Results of work done off the loop (password checks)
+ *             come back through the same inbox. Each worker keeps a timing wheel with one
+ *             timer per connection for the deadline of its current phase.
+ *
+ ****************************************************************************************/
+
+class TCPWorker
+{
+public:
+   TCPWorker(TCPServer &server);
+   ~TCPWorker();
+
+   // Starts the loop on a new thread, or runs it on the calling thread. An error that
+   // escapes the loop is handed to TCPServer::fail, which stops every worker.
+   void start();
+   void runLoop();
+   void join();
+
+   // Makes the loop return after its current pass--safe to call from any thread
+   void stop();
+
+   // Lets this worker accept connections on a server socket (single-threaded or sharded)
+   void watchListener(SocketFD &sockfd);
+
+   // Gives the worker a newly accepted, admitted socket--safe to call from any thread
+   void handoff(int fd, const sockaddr_in &peer);
+
+   // Adds a connection accepted on this worker's own loop. Loop thread only.
+   void addConn(int fd, const sockaddr_in &peer);
+
+   // Runs task on the loop's thread with the connection, then gives it a turn. Dropped if
+   // the connection has closed by then. Safe to call from any thread.
+   void post(ConnHandle conn, std::function<void(TCPConn &)> task);
+
+   // Turns watching a connection for writability on or off. Loop thread only.
+   void watchWritable(TCPConn *conn, bool watch);
+
+   // Number of connections owned by this worker, used for least-loaded assignment
+   unsigned int numConns() { return _numconns.load(std::memory_order_relaxed); };
+
+private:
+   struct Accepted {
+      int fd;
+      sockaddr_in peer;
+   };
+
+   void serveLoop();
+   void adoptConn(int fd, const sockaddr_in &peer);
+   void wake();
+   void drainInbox(std::vector<TCPConn *> &ready);
+   void reapConns(std::vector<TCPConn *> &closed);
+   void armTimer(TCPConn *conn, int64_t now_ms);
+
+   TCPServer &_server;
+
+   EventLoop _evloop;
+
+   // Server socket, only set when this worker also accepts
+   SocketFD *_listener = NULL;
+
+   // eventfd used to wake the loop when the inbox has new connections
+   int _wakefd;
+
+   std::thread _thread;
+   bool _threaded = false;
+
+   // Sockets handed over by the acceptor but not yet adopted, and tasks posted from other
+   // threads
+   std::mutex _inbox_mutex;
+   std::vector<Accepted> _inbox;
+   std::vector<std::pair<ConnHandle, std::function<void(TCPConn &)>>> _tasks;
+
+   // TCPConn objects owned by this worker. The loop registers each with epoll by handle.
+   ConnPool _conns;
+
+   // Connections that still had complete lines buffered after their last turn
+   std::vector<TCPConn *> _pending;
+
+   // Per-phase deadlines of this worker's connections
+   TimingWheel _timers;
+   ConnTimeouts _timeouts;
+
+   std::atomic<unsigned int> _numconns;
+   std::atomic<bool> _stopping;
+};
+
+#endif
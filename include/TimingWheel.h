@@ -0,0 +1,72 @@
+#ifndef TIMINGWHEEL_H
+#define TIMINGWHEEL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/****************************************************************************************
+ * TimerNode - Intrusive timer, embedded in the object it times so scheduling never
+ *             allocates. owner is handed back when the timer expires.
+ *
+ ****************************************************************************************/
+
+struct TimerNode {
+   TimerNode *prev = NULL;
+   TimerNode *next = NULL;       // NULL while not scheduled
+   uint64_t expires = 0;         // tick the timer fires on
+   uint8_t level = 0;
+   uint8_t slot = 0;
+   void *owner = NULL;
+
+   bool scheduled() const { return next != NULL; };
+};
+
+/****************************************************************************************
+ * TimingWheel - Hierarchical timing wheel. Timers go into one slot of four wheels by how
+ *               far off they are: the first wheel has a slot per tick, each later wheel a
+ *               slot per full turn of the one before. Slots are intrusive lists, so
+ *               scheduling and cancelling are O(1) no matter how many timers there are.
+ *               Each tick only looks at one first-wheel slot; when that wheel wraps, the
+ *               next slot of the wheel above is spread back down.
+ *
+ *               Not thread safe--each event loop keeps its own wheel.
+ *
+ ****************************************************************************************/
+
+class TimingWheel
+{
+public:
+   TimingWheel(unsigned int tick_ms = 100);
+   ~TimingWheel();
+
+   // Schedules (or reschedules) node to expire delay_ms after now_ms
+   void schedule(TimerNode &node, uint64_t delay_ms, int64_t now_ms);
+   void cancel(TimerNode &node);
+
+   // Moves time forward to now_ms, appending the owners of timers that expired
+   void advance(int64_t now_ms, std::vector<void *> &expired);
+
+   // Milliseconds until the next tick that could expire a timer, -1 if none are scheduled
+   int msUntilNext(int64_t now_ms);
+
+   size_t size() { return _count; };
+
+private:
+   static const unsigned int num_levels = 4;
+
+   void insert(TimerNode &node);
+   void cascade(unsigned int level, unsigned int slot);
+   TimerNode &head(unsigned int level, unsigned int slot);
+
+   unsigned int _tick_ms;
+   uint64_t _now_tick = 0;        // last tick processed
+   bool _started = false;
+   size_t _count = 0;
+
+   // Slot list heads for all levels, and which first-level slots are non-empty
+   std::vector<TimerNode> _slots;
+   uint64_t _occupied[4] = {0, 0, 0, 0};
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef WHITELIST_H
+#define WHITELIST_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <sys/stat.h>
+#include <sys/socket.h>
+
+/****************************************************************************************
+ * Whitelist - The addresses allowed to connect, loaded from a file with one IPv4 or IPv6
+ *             address or CIDR subnet per line ("10.1.2.3", "192.168.0.0/16", "fe80::/10").
+ *             Blank lines and lines starting with # are ignored.
+ *
+ *             Entries are kept in a binary prefix trie per address family and checked
+ *             against the raw sockaddr, so a check walks at most one node per prefix bit
+ *             and never formats the address. The trie is rebuilt off to the side when the
+ *             file changes and swapped in whole, so checks on other threads never wait for
+ *             or see a half-loaded list.
+ *
+ ****************************************************************************************/
+
+class Whitelist {
+   public:
+      Whitelist(const char *wl_file);
+      ~Whitelist();
+
+      // True if the address is covered by an entry. IPv4-mapped IPv6 addresses are
+      // checked against the IPv4 entries.
+      bool allowed(const sockaddr *addr);
+
+   private:
+      struct TrieNode {
+         uint32_t child[2] = {0, 0};   // 0 = no child (node 0 is a root, never a child)
+         bool terminal = false;        // an entry ends here, everything below is allowed
+      };
+
+      struct Table {
+         // nodes[0] is the IPv4 root, nodes[1] the IPv6 root
+         std::vector<TrieNode> nodes;
+         size_t entries = 0;
+
+         Table() : nodes(2) {};
+         void insert(unsigned int root, const uint8_t *addr, unsigned int prefix_len);
+         bool contains(unsigned int root, const uint8_t *addr, unsigned int bits) const;
+      };
+
+      std::shared_ptr<const Table> getTable();
+      void refreshTable(int64_t now);
+      bool parseEntry(const std::string &line, Table &table);
+
+      std::string _wl_file;
+
+      // Current table, swapped whole on reload
+      std::shared_ptr<const Table> _table;
+
+      // Guards reloads and the file identity the current table was loaded from
+      std::mutex _reload_mutex;
+      struct stat _loaded_stat;
+      std::atomic<int64_t> _next_check;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <sys/random.h>
+#include <errno.h>
+#include <cstring>
+#include <chrono>
+#include <stdexcept>
+#include "AuthCache.h"
+
+static int64_t nowMs() {
+   return std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************************************************************************
+ * SipHash - incremental SipHash-2-4, a keyed 64-bit PRF that is cheap for short inputs
+ **********************************************************************************************/
+
+class SipHash {
+public:
+   SipHash(const uint64_t key[2]) {
+      _v[0] = key[0] ^ 0x736f6d6570736575ULL;
+      _v[1] = key[1] ^ 0x646f72616e646f6dULL;
+      _v[2] = key[0] ^ 0x6c7967656e657261ULL;
+      _v[3] = key[1] ^ 0x7465646279746573ULL;
+   }
+
+   void update(const void *data, size_t len) {
+      const uint8_t *bytes = (const uint8_t *) data;
+      for (size_t i = 0; i < len; i++) {
+         _tail |= (uint64_t) bytes[i] << (8 * (_total % 8));
+         _total++;
+         if (_total % 8 == 0) {
+            absorb(_tail);
+            _tail = 0;
+         }
+      }
+   }
+
+   uint64_t final() {
+      absorb(_tail | ((uint64_t) (_total & 0xff) << 56));
+      _v[2] ^= 0xff;
+      for (int i = 0; i < 4; i++)
+         round();
+      return _v[0] ^ _v[1] ^ _v[2] ^ _v[3];
+   }
+
+private:
+   static uint64_t rotl(uint64_t x, int b) { return (x << b) | (x >> (64 - b)); };
+
+   void round() {
+      _v[0] += _v[1]; _v[1] = rotl(_v[1], 13); _v[1] ^= _v[0]; _v[0] = rotl(_v[0], 32);
+      _v[2] += _v[3]; _v[3] = rotl(_v[3], 16); _v[3] ^= _v[2];
+      _v[0] += _v[3]; _v[3] = rotl(_v[3], 21); _v[3] ^= _v[0];
+      _v[2] += _v[1]; _v[1] = rotl(_v[1], 17); _v[1] ^= _v[2]; _v[2] = rotl(_v[2], 32);
+   }
+
+   void absorb(uint64_t m) {
+      _v[3] ^= m;
+      round();
+      round();
+      _v[0] ^= m;
+   }
+
+   uint64_t _v[4];
+   uint64_t _tail = 0;
+   uint64_t _total = 0;
+};
+
+/**********************************************************************************************
+ * AuthCache (constructor) - sizes the table and draws the MAC keys
+ *
+ *    Params:  ttl_secs - how long a successful check is remembered
+ *             max_entries - most entries kept, rounded down to whole buckets. Callers
+ *                           reject anything under one bucket (ways).
+ *
+ *    Throws: runtime_error if no random key could be had
+ **********************************************************************************************/
+
+AuthCache::AuthCache(unsigned int ttl_secs, size_t max_entries):_ttl_ms((int64_t) ttl_secs * 1000) {
+   size_t buckets = 1;
+   while (buckets * 2 * ways <= max_entries)
+      buckets *= 2;
+   _entries.resize(buckets * ways);
+   _bucket_mask = buckets - 1;
+
+   uint64_t keys[6];
+   size_t got = 0;
+   while (got < sizeof(keys)) {
+      ssize_t results = getrandom((uint8_t *) keys + got, sizeof(keys) - got, 0);
+      if (results < 0) {
+         if (errno == EINTR)
+            continue;
+         throw std::runtime_error("Could not get random bytes for the auth cache key");
+      }
+      got += results;
+   }
+   memcpy(_key, keys, sizeof(_key));
+   memcpy(_name_key, keys + 4, sizeof(_name_key));
+   memset(keys, 0, sizeof(keys));
+}
+
+
+AuthCache::~AuthCache() {
+
+}
+
+/**********************************************************************************************
+ * computeMAC - the 128-bit tag an entry is stored under: two SipHashes, with independent
+ *              keys, of name, passwd, hash and salt. The NUL after each string keeps the split
+ *              between name and password unambiguous.
+ **********************************************************************************************/
+
+void AuthCache::computeMAC(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                           const std::vector<uint8_t> &salt, uint64_t mac[2]) {
+   for (int i = 0; i < 2; i++) {
+      SipHash sip(_key[i]);
+      sip.update(name, strlen(name) + 1);
+      sip.update(passwd, strlen(passwd) + 1);
+      sip.update(hash.data(), hash.size());
+      sip.update(salt.data(), salt.size());
+      mac[i] = sip.final();
+   }
+}
+
+uint64_t AuthCache::nameTag(const char *name) {
+   SipHash sip(_name_key);
+   sip.update(name, strlen(name));
+   return sip.final();
+}
+
+/**********************************************************************************************
+ * lookup - checks for an unexpired entry for exactly these credentials
+ **********************************************************************************************/
+
+bool AuthCache::lookup(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                                                             const std::vector<uint8_t> &salt) {
+   uint64_t mac[2];
+   computeMAC(name, passwd, hash, salt, mac);
+
+   size_t bucket = mac[0] & _bucket_mask;
+   int64_t now = nowMs();
+
+   std::lock_guard<std::mutex> lock(stripe(bucket));
+   for (unsigned int i = 0; i < ways; i++) {
+      Entry &entry = _entries[bucket * ways + i];
+      if ((entry.expires > now) && (entry.mac[0] == mac[0]) && (entry.mac[1] == mac[1]))
+         return true;
+   }
+   return false;
+}
+
+/**********************************************************************************************
+ * insert - remembers a successful check until the TTL runs out. Takes an empty or expired way
+ *          of the bucket, or else the one that expires soonest. A repeat login refreshes its
+ *          entry.
+ **********************************************************************************************/
+
+void AuthCache::insert(const char *name, const char *passwd, const std::vector<uint8_t> &hash,
+                                                             const std::vector<uint8_t> &salt) {
+   Entry fresh;
+   computeMAC(name, passwd, hash, salt, fresh.mac);
+   fresh.name_tag = nameTag(name);
+
+   size_t bucket = fresh.mac[0] & _bucket_mask;
+   int64_t now = nowMs();
+   fresh.expires = now + _ttl_ms;
+
+   std::lock_guard<std::mutex> lock(stripe(bucket));
+   Entry *victim = &_entries[bucket * ways];
+   for (unsigned int i = 0; i < ways; i++) {
+      Entry &entry = _entries[bucket * ways + i];
+      if ((entry.mac[0] == fresh.mac[0]) && (entry.mac[1] == fresh.mac[1])) {
+         victim = &entry;
+         break;
+      }
+      if (entry.expires < victim->expires)
+         victim = &entry;
+   }
+   *victim = fresh;
+}
+
+/**********************************************************************************************
+ * invalidate - drops the user's entries. Entries are placed by MAC, not name, so this walks the
+ *              whole table--fine for something as rare as a password change.
+ **********************************************************************************************/
+
+void AuthCache::invalidate(const char *name) {
+   uint64_t tag = nameTag(name);
+   size_t buckets = _bucket_mask + 1;
+
+   for (size_t bucket = 0; bucket < buckets; bucket++) {
+      std::lock_guard<std::mutex> lock(stripe(bucket));
+      for (unsigned int i = 0; i < ways; i++) {
+         Entry &entry = _entries[bucket * ways + i];
+         if (entry.name_tag == tag)
+            entry = Entry();
+      }
+   }
+}
@@ -0,0 +1,115 @@
+#include <strings.h>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include "CommandTable.h"
+
+// Seeds tried at one table size before the table is doubled
+const uint32_t max_seed_tries = 1000;
+
+/**********************************************************************************************
+ * add - registers a command and rebuilds the hash so it has a slot of its own
+ *
+ *    Params:  name - what the user types, matched without regard to case
+ *             reply - static text queued without copying, NULL for none
+ *             reply_len - length of reply, or strlen(reply) if not given
+ *             handler - called after the reply is queued, NULL for reply-only commands
+ **********************************************************************************************/
+
+void CommandTable::add(const char *name, const char *reply, Handler handler) {
+   add(name, reply, (reply != NULL) ? strlen(reply) : 0, handler);
+}
+
+void CommandTable::add(const char *name, const char *reply, size_t reply_len, Handler handler) {
+   Command cmd;
+   cmd.name = name;
+   for (char &c : cmd.name)
+      c = tolower((unsigned char) c);
+   cmd.reply = reply;
+   cmd.reply_len = (reply != NULL) ? reply_len : 0;
+   cmd.handler = handler;
+
+   bool replaced = false;
+   for (Command &existing : _commands) {
+      if (existing.name == cmd.name) {
+         existing = cmd;
+         replaced = true;
+      }
+   }
+   if (!replaced)
+      _commands.push_back(cmd);
+
+   rebuild();
+}
+
+/**********************************************************************************************
+ * find - looks up what the user typed
+ *
+ *    Returns: the command, or NULL if no command has that name
+ **********************************************************************************************/
+
+const CommandTable::Command *CommandTable::find(std::string_view name) const {
+   if (_slots.empty() || name.empty() || (name.size() > _max_len))
+      return NULL;
+
+   int idx = _slots[hashName(name, _seed) & _mask];
+   if (idx < 0)
+      return NULL;
+
+   const Command &cmd = _commands[idx];
+   if ((cmd.name.size() != name.size()) ||
+       (strncasecmp(cmd.name.data(), name.data(), name.size()) != 0))
+      return NULL;
+   return &cmd;
+}
+
+/**********************************************************************************************
+ * hashName - FNV-1a over the lowercased name, mixed with a seed
+ **********************************************************************************************/
+
+uint32_t CommandTable::hashName(std::string_view name, uint32_t seed) {
+   uint32_t hash = 2166136261u ^ (seed * 0x9e3779b9u);
+   for (char c : name) {
+      hash ^= (uint8_t) tolower((unsigned char) c);
+      hash *= 16777619u;
+   }
+   return hash ^ (hash >> 15);
+}
+
+/**********************************************************************************************
+ * rebuild - finds a seed that puts every command in its own slot, starting at a table twice
+ *           the number of commands and doubling it if no seed works
+ **********************************************************************************************/
+
+void CommandTable::rebuild() {
+   size_t size = 2;
+   while (size < _commands.size() * 2)
+      size <<= 1;
+
+   _max_len = 0;
+   for (const Command &cmd : _commands)
+      _max_len = std::max(_max_len, cmd.name.size());
+
+   while (true) {
+      for (uint32_t seed = 0; seed < max_seed_tries; seed++) {
+         std::vector<int> slots(size, -1);
+         bool collided = false;
+
+         for (size_t i = 0; (i < _commands.size()) && !collided; i++) {
+            int &slot = slots[hashName(_commands[i].name, seed) & (size - 1)];
+            if (slot >= 0)
+               collided = true;
+            else
+               slot = i;
+         }
+
+         if (!collided) {
+            _slots.swap(slots);
+            _seed = seed;
+            _mask = size - 1;
+            return;
+         }
+      }
+      size <<= 1;
+   }
+}
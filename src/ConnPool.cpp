@@ -0,0 +1,80 @@
+#include <new>
+#include "ConnPool.h"
+
+ConnPool::ConnPool() {
+
+}
+
+/**********************************************************************************************
+ * ~ConnPool - destroys any connections still live (closing their sockets) before the slabs
+ *             go away
+ **********************************************************************************************/
+
+ConnPool::~ConnPool() {
+   for (uint32_t idx : _active)
+      slotConn(idx)->~TCPConn();
+}
+
+/**********************************************************************************************
+ * addSlab - allocates slab_conns more slots. Their indexes go on the free list highest first,
+ *           so the lowest is handed out next and the table fills from the front.
+ **********************************************************************************************/
+
+void ConnPool::addSlab() {
+   uint32_t base = _slots.size();
+
+   _slabs.emplace_back(new Slot[slab_conns]);
+   _slots.resize(base + slab_conns);
+   for (uint32_t i = slab_conns; i > 0; i--)
+      _free.push_back(base + i - 1);
+}
+
+/**********************************************************************************************
+ * create - constructs a TCPConn in the most recently freed slot and gives it its handle
+ *
+ *    Params:  the TCPConn constructor's arguments
+ *
+ *    Returns: the new connection, which stays at the same address until it is released
+ **********************************************************************************************/
+
+TCPConn *ConnPool::create(int fd, const sockaddr_in &peer, LogSvr *logSvr, PasswdMgr *pwdMgr,
+                                                                           HashPool *hashPool) {
+   if (_free.empty())
+      addSlab();
+
+   uint32_t idx = _free.back();
+   TCPConn *conn = new (slotConn(idx)) TCPConn(fd, peer, logSvr, pwdMgr, hashPool);
+   _free.pop_back();
+
+   SlotInfo &info = _slots[idx];
+   info.gen++;
+   info.pos = _active.size();
+   _active.push_back(idx);
+
+   conn->setHandle(((ConnHandle) info.gen << 32) | idx);
+   return conn;
+}
+
+/**********************************************************************************************
+ * release - destroys a connection, bumps its slot's generation so old handles stop matching
+ *           and puts the slot at the top of the free list
+ **********************************************************************************************/
+
+void ConnPool::release(TCPConn *conn) {
+   ConnHandle handle = conn->getHandle();
+   if (lookup(handle) != conn)
+      return;
+
+   uint32_t idx = (uint32_t) handle;
+   conn->~TCPConn();
+
+   // Fill the hole in the packed array with its last entry
+   SlotInfo &info = _slots[idx];
+   uint32_t moved = _active.back();
+   _active[info.pos] = moved;
+   _slots[moved].pos = info.pos;
+   _active.pop_back();
+
+   info.gen++;
+   _free.push_back(idx);
+}
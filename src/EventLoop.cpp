@@ -0,0 +1,98 @@
+#include <errno.h>
+#include <unistd.h>
+#include <strings.h>
+#include "EventLoop.h"
+
+/****************************************************************************************
+ * EventLoop (constructor) - creates the epoll instance
+ *
+ *    Params:  max_events - the most ready FDs returned by a single waitEvents call
+ *
+ *    Throws: socket_error if the epoll instance could not be created
+ ****************************************************************************************/
+
+EventLoop::EventLoop(unsigned int max_events):_events(max_events) {
+   if ((_epfd = epoll_create1(EPOLL_CLOEXEC)) == -1)
+      throw socket_error("Failed creating epoll instance.");
+}
+
+EventLoop::~EventLoop() {
+   close(_epfd);
+}
+
+/****************************************************************************************
+ * addFD/modFD - registers an FD (or changes its registration) with the epoll instance
+ *
+ *    Params:  fd - the file descriptor to watch
+ *             events - epoll event flags, normally EPOLLIN | EPOLLET
+ *             data - pointer handed back by getData when the FD is ready, or
+ *             tag - value handed back by getTag
+ *
+ *    Throws: socket_error if epoll_ctl fails
+ ****************************************************************************************/
+
+void EventLoop::addFD(int fd, uint32_t events, void *data) {
+   epoll_data_t ed;
+   ed.ptr = data;
+   ctlFD(EPOLL_CTL_ADD, fd, events, ed);
+}
+
+void EventLoop::modFD(int fd, uint32_t events, void *data) {
+   epoll_data_t ed;
+   ed.ptr = data;
+   ctlFD(EPOLL_CTL_MOD, fd, events, ed);
+}
+
+void EventLoop::addFD(int fd, uint32_t events, uint64_t tag) {
+   epoll_data_t ed;
+   ed.u64 = tag;
+   ctlFD(EPOLL_CTL_ADD, fd, events, ed);
+}
+
+void EventLoop::modFD(int fd, uint32_t events, uint64_t tag) {
+   epoll_data_t ed;
+   ed.u64 = tag;
+   ctlFD(EPOLL_CTL_MOD, fd, events, ed);
+}
+
+void EventLoop::ctlFD(int op, int fd, uint32_t events, epoll_data_t data) {
+   epoll_event ev;
+   bzero(&ev, sizeof(ev));
+   ev.events = events;
+   ev.data = data;
+
+   if (epoll_ctl(_epfd, op, fd, &ev) == -1) {
+      if (op == EPOLL_CTL_ADD)
+         throw socket_error("Failed adding file descriptor to epoll.");
+      throw socket_error("Failed modifying file descriptor in epoll.");
+   }
+}
+
+/****************************************************************************************
+ * delFD - removes an FD from the epoll instance. Closing an FD removes it automatically,
+ *         so this is only needed when an FD outlives its registration.
+ ****************************************************************************************/
+
+void EventLoop::delFD(int fd) {
+   epoll_ctl(_epfd, EPOLL_CTL_DEL, fd, NULL);
+}
+
+/****************************************************************************************
+ * waitEvents - blocks until one or more registered FDs are ready
+ *
+ *    Params:  ms_timeout - milliseconds to wait, 0 to poll, -1 to wait forever
+ *
+ *    Returns: number of ready FDs (0 on timeout or signal interruption)
+ *
+ *    Throws: socket_error for unrecoverable epoll errors
+ ****************************************************************************************/
+
+int EventLoop::waitEvents(int ms_timeout) {
+   int n = epoll_wait(_epfd, _events.data(), _events.size(), ms_timeout);
+   if (n == -1) {
+      if (errno == EINTR)
+         return 0;
+      throw socket_error("epoll_wait failed.");
+   }
+   return n;
+}
@@ -89,27 +89,59 @@ bool FileDesc::hasData(long ms_timeout) {
 }
 
 /*****************************************************************************************
- * readFD - simply reads all available string data (up to bufsize) from the FD
+ * readFD - simply reads all available data (up to bufsize) from the FD. The data is kept
+ *          byte for byte, including any NULs.
  *
- *    Params: buf - string to store the data in
+ *    Params: buf - string to store the data in (replaced)
  *
  *    Returns: returns the amount of data read or -1 for failure
  *****************************************************************************************/
 
 ssize_t FileDesc::readFD(std::string &buf) {
-   char *readbuf = new char[bufsize];
-   bzero(readbuf, sizeof(char) * bufsize);
+   char readbuf[bufsize];
    ssize_t amt_read = 0;
-   if ((amt_read = read(_fd, readbuf, bufsize)) < 0) {
-      delete readbuf;
+   if ((amt_read = read(_fd, readbuf, bufsize)) < 0)
       return -1;
-   }
-   
-   buf = readbuf;
-   delete readbuf;
+
+   buf.assign(readbuf, amt_read);
    return amt_read;
 }
 
+/*****************************************************************************************
+ * readFD - reads available data directly into a caller's buffer
+ *
+ *    Params: buf - where to store the data
+ *            len - most bytes to read
+ *
+ *    Returns: returns the amount of data read or -1 for failure (errno is left set)
+ *****************************************************************************************/
+
+ssize_t FileDesc::readFD(char *buf, size_t len) {
+   return read(_fd, buf, len);
+}
+
+/*****************************************************************************************
+ * readAll - reads from the FD until end of file, where readFD returns after one read of at
+ *           most bufsize. The data is kept byte for byte, including any NULs.
+ *
+ *    Params: buf - string to store the data in (replaced)
+ *
+ *    Returns: returns the amount of data read or -1 for failure
+ *****************************************************************************************/
+
+ssize_t FileDesc::readAll(std::string &buf) {
+   char readbuf[65536];
+   ssize_t amt_read = 0;
+
+   buf.clear();
+   while ((amt_read = read(_fd, readbuf, sizeof(readbuf))) > 0)
+      buf.append(readbuf, amt_read);
+
+   if (amt_read < 0)
+      return -1;
+   return buf.size();
+}
+
 /*****************************************************************************************
  * writeFD - writes all the string data provided in str to the FD
  *
@@ -130,6 +162,18 @@ ssize_t FileDesc::writeFD(const char *data, unsigned int len) {
    return write(_fd, data, len);
 }
 
+/*****************************************************************************************
+ * writevFD - writes several buffers with a single writev call
+ *
+ *    Params: iov, iovcnt - the buffers to write, in order
+ *
+ *    Returns: returns the amount written (may be short) for success, -1 for failure
+ *****************************************************************************************/
+
+ssize_t FileDesc::writevFD(const struct iovec *iov, int iovcnt) {
+   return writev(_fd, iov, iovcnt);
+}
+
 /*************************************************************************************
  * isOpen - determines if the file descriptor is open for both reading and writing
  *          
@@ -143,10 +187,14 @@ bool FileDesc::isOpen() {
 }
 
 /***************************************************************************************
- * closeFD - closes the FD cleanly
+ * closeFD - closes the FD cleanly and marks it closed so the number can't be reused by
+ *           mistake once the kernel hands it out again
  ***************************************************************************************/
 void FileDesc::closeFD() {
+   if (_fd < 0)
+      return;
    close(_fd);
+   _fd = -1;
 }
 
 /****************************************************************************************
@@ -165,8 +213,30 @@ SocketFD::SocketFD():FileDesc() {
    }
 }
 
+/****************************************************************************************
+ * SocketFD (constructor) - Takes ownership of an already connected socket, such as one
+ *                          returned by acceptRaw, without creating a socket of its own
+ ****************************************************************************************/
+
+SocketFD::SocketFD(int fd, const sockaddr_in &addr):FileDesc(), _fd_addr(addr) {
+   _fd = fd;
+}
+
 SocketFD::~SocketFD() {
+   closeFD();
+}
+
+/*****************************************************************************************
+ * setReusePort - sets SO_REUSEPORT so several listening sockets can share one address and
+ *                port, with the kernel spreading incoming connections across them
+ *
+ *    Throws: socket_error if the option could not be set
+ *****************************************************************************************/
 
+void SocketFD::setReusePort() {
+   int one = 1;
+   if (setsockopt(_fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) != 0)
+      throw socket_error("Failed setting SO_REUSEPORT on socket.");
 }
 
 /*****************************************************************************************
@@ -245,13 +315,31 @@ void SocketFD::listenFD(int backlog) {
 bool SocketFD::acceptFD(SocketFD &server) {
    socklen_t len = sizeof(_fd_addr);
 
-   _fd = accept(server.getFD(), (struct sockaddr *) &_fd_addr, &len);
-   if (_fd == -1)
+   int newfd = accept(server.getFD(), (struct sockaddr *) &_fd_addr, &len);
+   if (newfd == -1)
       return false;
 
+   // Replace the unused socket created by the constructor
+   closeFD();
+   _fd = newfd;
    return true;
 }
 
+/*****************************************************************************************
+ * acceptRaw - accepts a connection from this (listening) socket without wrapping it, so the
+ *             caller can vet the peer before spending anything on it. The new FD is already
+ *             non-blocking and close-on-exec.
+ *
+ *    Params: addr - filled in with the peer's address
+ *
+ *    Returns: the new FD, or -1 if the accept failed (EAGAIN when the queue is empty)
+ *****************************************************************************************/
+
+int SocketFD::acceptRaw(sockaddr_in &addr) {
+   socklen_t len = sizeof(addr);
+   return accept4(_fd, (struct sockaddr *) &addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+}
+
 /*****************************************************************************************
  * getIPAddr - returns the IP address of this FD in big endian format
  *
@@ -0,0 +1,98 @@
+#include <algorithm>
+#include "HashPool.h"
+
+/**********************************************************************************************
+ * HashPool (constructor) - starts the pool threads
+ *
+ *    Params:  num_threads - number of threads, and so the number of jobs run at once (min 1)
+ **********************************************************************************************/
+
+HashPool::HashPool(unsigned int num_threads) {
+   num_threads = std::max(1u, num_threads);
+   _limit = num_threads;
+   for (unsigned int i = 0; i < num_threads; i++)
+      _threads.emplace_back(&HashPool::runJobs, this);
+}
+
+/**********************************************************************************************
+ * HashPool (destructor) - lets the threads finish the queued jobs, then joins them
+ **********************************************************************************************/
+
+HashPool::~HashPool() {
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stopping = true;
+   }
+   _cond.notify_all();
+
+   for (auto &thread : _threads)
+      thread.join();
+}
+
+/**********************************************************************************************
+ * submit - queues a job for the pool. Never blocks on the hashing itself.
+ **********************************************************************************************/
+
+void HashPool::submit(std::function<void()> job) {
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _jobs.push_back(std::move(job));
+   }
+   _cond.notify_one();
+}
+
+/**********************************************************************************************
+ * threadsForCap - works out how many hashes can run at once without going over a memory cap
+ *
+ *    Params:  mem_cap - total bytes allowed for hashing
+ *             hash_mem - bytes a single hash allocates
+ *
+ *    Returns: number of threads, at least 1 and no more than the number of cores
+ **********************************************************************************************/
+
+unsigned int HashPool::threadsForCap(size_t mem_cap, size_t hash_mem) {
+   size_t fit = mem_cap / hash_mem;
+   size_t cores = std::max(1u, std::thread::hardware_concurrency());
+
+   return (unsigned int) std::max((size_t) 1, std::min(fit, cores));
+}
+
+/**********************************************************************************************
+ * setLimit - caps how many jobs run at once without changing the number of threads. Jobs
+ *            already running finish; the cap applies to the next ones started.
+ **********************************************************************************************/
+
+void HashPool::setLimit(unsigned int max_running) {
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _limit = std::min(std::max(1u, max_running), (unsigned int) _threads.size());
+   }
+   _cond.notify_all();
+}
+
+/**********************************************************************************************
+ * runJobs - pool thread body, runs queued jobs one at a time, while fewer than the limit are
+ *           running, until the pool is stopped
+ **********************************************************************************************/
+
+void HashPool::runJobs() {
+   std::unique_lock<std::mutex> lock(_mutex);
+   while (true) {
+      _cond.wait(lock, [this] {
+         return (_stopping && _jobs.empty()) || (!_jobs.empty() && (_running < _limit));
+      });
+      if (_jobs.empty())
+         return;
+
+      std::function<void()> job = std::move(_jobs.front());
+      _jobs.pop_front();
+      _running++;
+
+      lock.unlock();
+      job();
+      lock.lock();
+
+      _running--;
+      _cond.notify_all();
+   }
+}
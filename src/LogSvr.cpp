@@ -1,26 +1,241 @@
+#include <netinet/in.h>
+#include <algorithm>
+#include <cstring>
+#include <ctime>
 #include "LogSvr.h"
+#include "exceptions.h"
 
-LogSvr::LogSvr(const char* logname):logLocation(logname) {
+// Slots in the ring and most events written in a single batch
+const size_t log_ring_size = 4096;
+const size_t log_batch_max = 256;
+
+// Most usernames given ids in one session, later ones are logged without a user
+const size_t log_max_users = 65536;
+
+// How long an idle writer sleeps before checking the ring again anyway
+const std::chrono::milliseconds log_idle_wait(50);
+
+// Rejected connections are summed over this long (ns) before being written
+const int64_t log_reject_interval = 1000000000LL;
+
+static int64_t nowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+LogSvr::LogSvr(const char* logname, fsync_policy policy, unsigned int sync_ms)
+                    :logLocation(logname), syncPolicy(policy), ring(log_ring_size) {
+    syncIntervalNs = (int64_t) sync_ms * 1000000;
+
+    if ((logfd = open(logname, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) == -1)
+        throw logfile_error("Could not open log file");
+
+    // Start a new session so readers know user ids start over
+    EvRecord session;
+    memset(&session, 0, sizeof(session));
+    session.kind = rec_session;
+    session.ts_ns = nowNs();
+    memcpy(session.session.magic, evlog_magic, sizeof(evlog_magic));
+    session.session.version = evlog_version;
+    if (write(logfd, &session, sizeof(session)) != sizeof(session))
+        throw logfile_error("Could not write to log file");
+
+    batchRecs.reserve(log_batch_max * 2 + 1);
+    writer = std::thread(&LogSvr::writeLoop, this);
 }
 
 LogSvr::~LogSvr() {
+    stopping.store(true);
+    idleCond.notify_one();
+    writer.join();
+    close(logfd);
+}
+
+/*****************************************************************************************
+ * setSyncPolicy - changes when the writer syncs the file. Safe while the writer runs; the
+ *                 session record written at open is unaffected.
+ *****************************************************************************************/
+
+void LogSvr::setSyncPolicy(fsync_policy policy, unsigned int sync_ms) {
+    syncIntervalNs.store((int64_t) sync_ms * 1000000, std::memory_order_relaxed);
+    syncPolicy.store(policy, std::memory_order_relaxed);
+}
+
+/*****************************************************************************************
+ * logEvent - queues an event. Never blocks: if the writer has fallen a whole ring behind,
+ *            the event is dropped and counted instead.
+ *
+ *    Params:  event, outcome - what happened
+ *             peer - the remote address, if any
+ *             username - the user involved, if any (empty counts as none)
+ *             value - event specific value
+ *****************************************************************************************/
+
+void LogSvr::logEvent(evlog_event event, evlog_outcome outcome, const sockaddr *peer,
+                      const char *username, uint64_t value) {
+    int64_t now = nowNs();
+
+    bool queued = ring.tryPush([&](LogEntry &entry) {
+        entry.ts_ns = now;
+        entry.value = value;
+        entry.event = event;
+        entry.outcome = outcome;
+        entry.family = 0;
+        memset(entry.addr, 0, sizeof(entry.addr));
+
+        if ((peer != NULL) && (peer->sa_family == AF_INET)) {
+            entry.family = 4;
+            memcpy(entry.addr, &((const sockaddr_in *) peer)->sin_addr, 4);
+        } else if ((peer != NULL) && (peer->sa_family == AF_INET6)) {
+            entry.family = 6;
+            memcpy(entry.addr, &((const sockaddr_in6 *) peer)->sin6_addr, 16);
+        }
+
+        entry.namelen = (username == NULL) ? 0 : strnlen(username, evlog_namelen - 1);
+        memcpy(entry.name, username, entry.namelen);
+    });
+
+    if (!queued) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Pairs with the fence in writeLoop so at least one side sees the other
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writerIdle.load(std::memory_order_relaxed))
+        idleCond.notify_one();
 }
 
-void LogSvr::logString(std::string logString) {
-    logfile.open(logLocation, std::ios_base::app);
-    std::string dateTime = CurrentDate();
-    logString += dateTime;
-    logString += "\n";
-    logfile.write(logString.c_str(), logString.length());
-    logfile.flush();
-    logfile.close();
+/*****************************************************************************************
+ * writeLoop - writer thread body. Writes batches while there is anything queued, then
+ *             sleeps until a producer notifies it (or the idle wait runs out, in case a
+ *             notify slipped in just before it went to sleep).
+ *****************************************************************************************/
+
+void LogSvr::writeLoop() {
+    while (true) {
+        if (writeBatch() > 0)
+            continue;
+
+        if (stopping.load())
+            break;
+
+        std::unique_lock<std::mutex> lock(idleMutex);
+        writerIdle.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (ring.peek(0) == NULL)
+            idleCond.wait_for(lock, log_idle_wait);
+        writerIdle.store(false, std::memory_order_relaxed);
+    }
+}
+
+/*****************************************************************************************
+ * writeBatch - turns up to log_batch_max queued events into records (adding name records
+ *              for usernames not seen before), along with any due drop and rejection counts,
+ *              writes them with one call and releases the ring slots
+ *
+ *    Returns: number of records written
+ *****************************************************************************************/
+
+size_t LogSvr::writeBatch() {
+    batchRecs.clear();
+
+    uint64_t lost = dropped.exchange(0, std::memory_order_relaxed);
+    if (lost > 0) {
+        EvRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = rec_event;
+        rec.event = ev_dropped;
+        rec.outcome = out_fail;
+        rec.ts_ns = nowNs();
+        rec.ev.value = lost;
+        batchRecs.push_back(rec);
+    }
+
+    int64_t now = nowNs();
+    if ((now - lastRejectNs >= log_reject_interval) && (rejected.load() > 0)) {
+        EvRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.kind = rec_event;
+        rec.event = ev_connect;
+        rec.outcome = out_rejected;
+        rec.ts_ns = now;
+        rec.ev.value = rejected.exchange(0, std::memory_order_relaxed);
+        batchRecs.push_back(rec);
+        lastRejectNs = now;
+    }
+
+    size_t n = 0;
+    LogEntry *entry;
+    while ((n < log_batch_max) && ((entry = ring.peek(n)) != NULL)) {
+        EvRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.user_id = userId(entry->name, entry->namelen, batchRecs);
+        rec.kind = rec_event;
+        rec.event = entry->event;
+        rec.outcome = entry->outcome;
+        rec.family = entry->family;
+        rec.ts_ns = entry->ts_ns;
+        rec.ev.value = entry->value;
+        memcpy(rec.ev.addr, entry->addr, sizeof(rec.ev.addr));
+        batchRecs.push_back(rec);
+        n++;
+    }
+    ring.release(n);
+
+    if (batchRecs.empty())
+        return 0;
+
+    writeRecords(batchRecs);
+    return batchRecs.size();
+}
+
+/*****************************************************************************************
+ * userId - returns the id for a username, adding a name record to out the first time the
+ *          name is seen in this session
+ *****************************************************************************************/
+
+uint32_t LogSvr::userId(const char *name, size_t len, std::vector<EvRecord> &out) {
+    if (len == 0)
+        return evlog_nouser;
+
+    std::string key(name, len);
+    auto found = userIds.find(key);
+    if (found != userIds.end())
+        return found->second;
+
+    if (userIds.size() >= log_max_users)
+        return evlog_nouser;
+
+    uint32_t id = userIds.size() + 1;
+    userIds.emplace(key, id);
+
+    EvRecord rec;
+    memset(&rec, 0, sizeof(rec));
+    rec.kind = rec_name;
+    rec.user_id = id;
+    rec.ts_ns = nowNs();
+    memcpy(rec.name, name, len);
+    out.push_back(rec);
+    return id;
 }
 
-std::string LogSvr::CurrentDate()
-{
-    std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+/*****************************************************************************************
+ * writeRecords - writes a batch of records and syncs according to the fsync policy. A
+ *                failed log write shouldn't take the server down, so it is only reported.
+ *****************************************************************************************/
 
-    char buf[100] = {0};
-    std::strftime(buf, sizeof(buf), "%H:%M:%S  %Y-%m-%d", std::localtime(&now));
-    return buf;
-}
\ No newline at end of file
+void LogSvr::writeRecords(const std::vector<EvRecord> &out) {
+    size_t len = out.size() * sizeof(EvRecord);
+    if (write(logfd, out.data(), len) != (ssize_t) len)
+        std::cerr << "Failed writing to log file " << logLocation << std::endl;
+
+    int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+    fsync_policy policy = syncPolicy.load(std::memory_order_relaxed);
+    if ((policy == sync_batch) || ((policy == sync_interval) &&
+                      (now - lastSyncNs >= syncIntervalNs.load(std::memory_order_relaxed)))) {
+        fdatasync(logfd);
+        lastSyncNs = now;
+    }
+}
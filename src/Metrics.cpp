@@ -0,0 +1,225 @@
+#include <stdio.h>
+#include <chrono>
+#include <mutex>
+#include <vector>
+#include <memory>
+#include "Metrics.h"
+
+std::atomic<bool> Metrics::_enabled(false);
+
+// Names and help text, in enum order
+static const char *const stage_names[Metrics::num_stages] = {
+   "accept", "whitelist", "user_lookup", "argon2", "dispatch", "flush"
+};
+
+struct CounterInfo {
+   const char *name;
+   const char *help;
+};
+
+static const CounterInfo counter_info[Metrics::num_counters] = {
+   {"tcpserver_connections_accepted_total", "Connections accepted and admitted by the whitelist"},
+   {"tcpserver_connections_rejected_total", "Connections turned away by the whitelist"},
+   {"tcpserver_connections_closed_total", "Admitted connections that have since closed"},
+   {"tcpserver_logins_succeeded_total", "Password checks that matched"},
+   {"tcpserver_logins_failed_total", "Password checks that did not match"},
+   {"tcpserver_auth_cache_hits_total", "Password checks answered by the credential cache"},
+   {"tcpserver_commands_total", "Menu commands handled"},
+};
+
+// Quantiles reported from the histograms
+static const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+
+// Histogram buckets are reported to Prometheus at each power of two from here up
+static const unsigned int first_reported_exp = 7;   // 128 ns
+
+/**********************************************************************************************
+ * Block - one thread's counters. Only the owning thread writes, so increments are a plain
+ *         relaxed load and store rather than a locked read-modify-write.
+ **********************************************************************************************/
+
+struct Metrics::Block {
+   std::atomic<uint64_t> counters[num_counters];
+   std::atomic<uint64_t> sum_ns[num_stages];
+   std::atomic<uint64_t> buckets[num_stages][num_buckets];
+
+   Block() {
+      for (auto &counter : counters)
+         counter.store(0, std::memory_order_relaxed);
+      for (auto &sum : sum_ns)
+         sum.store(0, std::memory_order_relaxed);
+      for (auto &stage : buckets)
+         for (auto &bucket : stage)
+            bucket.store(0, std::memory_order_relaxed);
+   }
+};
+
+static void bump(std::atomic<uint64_t> &value, uint64_t n) {
+   value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+// Every block ever handed out, kept after their threads exit so totals never go backwards
+static std::mutex registry_mutex;
+static std::vector<std::unique_ptr<Metrics::Block>> registry;
+
+/**********************************************************************************************
+ * threadBlock - the calling thread's block, registered on first use
+ **********************************************************************************************/
+
+Metrics::Block &Metrics::threadBlock() {
+   thread_local Block *block = NULL;
+
+   if (block == NULL) {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      registry.emplace_back(new Block());
+      block = registry.back().get();
+   }
+   return *block;
+}
+
+/**********************************************************************************************
+ * count / record - add to a counter, or a duration in ns to a stage's histogram
+ **********************************************************************************************/
+
+void Metrics::count(counter_type counter, uint64_t n) {
+   if (!enabled())
+      return;
+   bump(threadBlock().counters[counter], n);
+}
+
+void Metrics::record(stage_type stage, uint64_t ns) {
+   if (!enabled())
+      return;
+   Block &block = threadBlock();
+   bump(block.buckets[stage][bucketFor(ns)], 1);
+   bump(block.sum_ns[stage], ns);
+}
+
+int64_t Metrics::startTime() {
+   if (!enabled())
+      return 0;
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************************************************************************
+ * bucketFor - the histogram bucket for a duration. Values under 8 ns get a bucket each; above
+ *             that, each power of two is split in 8 by the 3 bits below its top bit.
+ **********************************************************************************************/
+
+unsigned int Metrics::bucketFor(uint64_t ns) {
+   if (ns < sub_count)
+      return (unsigned int) ns;
+
+   unsigned int exp = 63 - __builtin_clzll(ns);
+   if (exp > max_exp)
+      return num_buckets - 1;
+
+   return (exp - sub_bits + 1) * sub_count + ((ns >> (exp - sub_bits)) & (sub_count - 1));
+}
+
+/**********************************************************************************************
+ * bucketLow - the smallest duration that lands in a bucket
+ **********************************************************************************************/
+
+uint64_t Metrics::bucketLow(unsigned int bucket) {
+   if (bucket < sub_count)
+      return bucket;
+
+   unsigned int exp = bucket / sub_count + sub_bits - 1;
+   return (uint64_t) (sub_count + bucket % sub_count) << (exp - sub_bits);
+}
+
+static void appendf(std::string &out, const char *fmt, const char *name, double value) {
+   char line[256];
+   snprintf(line, sizeof(line), fmt, name, value);
+   out += line;
+}
+
+/**********************************************************************************************
+ * render - sums every thread's block and appends the Prometheus text format: the counters,
+ *          a histogram per stage (cumulative buckets at each power of two), and quantiles
+ *          estimated from the fine buckets as a separate gauge. All cover the whole uptime.
+ **********************************************************************************************/
+
+void Metrics::render(std::string &out) {
+   uint64_t counters[num_counters] = {};
+   uint64_t sum_ns[num_stages] = {};
+   std::vector<uint64_t> buckets(num_stages * num_buckets, 0);
+
+   {
+      std::lock_guard<std::mutex> lock(registry_mutex);
+      for (const auto &block : registry) {
+         for (unsigned int i = 0; i < num_counters; i++)
+            counters[i] += block->counters[i].load(std::memory_order_relaxed);
+         for (unsigned int s = 0; s < num_stages; s++) {
+            sum_ns[s] += block->sum_ns[s].load(std::memory_order_relaxed);
+            for (unsigned int b = 0; b < num_buckets; b++)
+               buckets[s * num_buckets + b] += block->buckets[s][b].load(std::memory_order_relaxed);
+         }
+      }
+   }
+
+   for (unsigned int i = 0; i < num_counters; i++) {
+      out += "# HELP ";
+      out += counter_info[i].name;
+      out += ' ';
+      out += counter_info[i].help;
+      out += "\n# TYPE ";
+      out += counter_info[i].name;
+      out += " counter\n";
+      out += counter_info[i].name;
+      out += ' ' + std::to_string(counters[i]) + '\n';
+   }
+
+   out += "# HELP tcpserver_stage_duration_seconds Time spent in each hot-path stage\n";
+   out += "# TYPE tcpserver_stage_duration_seconds histogram\n";
+   for (unsigned int s = 0; s < num_stages; s++) {
+      const uint64_t *hist = &buckets[s * num_buckets];
+      uint64_t total = 0;
+      unsigned int b = 0;
+
+      // Every bucket below 2^exp ns counts toward le="2^exp ns"
+      for (unsigned int exp = first_reported_exp; exp <= max_exp; exp++) {
+         while ((b < num_buckets) && (bucketLow(b) < (1ULL << exp)))
+            total += hist[b++];
+         appendf(out, "tcpserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.9g\"} ",
+                                                stage_names[s], (double) (1ULL << exp) / 1e9);
+         out += std::to_string(total) + '\n';
+      }
+      while (b < num_buckets)
+         total += hist[b++];
+
+      appendf(out, "tcpserver_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %.0f\n",
+                                                                stage_names[s], (double) total);
+      appendf(out, "tcpserver_stage_duration_seconds_sum{stage=\"%s\"} %.9g\n", stage_names[s],
+                                                                       (double) sum_ns[s] / 1e9);
+      appendf(out, "tcpserver_stage_duration_seconds_count{stage=\"%s\"} %.0f\n", stage_names[s],
+                                                                                 (double) total);
+   }
+
+   out += "# HELP tcpserver_stage_quantile_seconds Upper bound of each quantile of stage time\n";
+   out += "# TYPE tcpserver_stage_quantile_seconds gauge\n";
+   for (unsigned int s = 0; s < num_stages; s++) {
+      const uint64_t *hist = &buckets[s * num_buckets];
+      uint64_t total = 0;
+      for (unsigned int b = 0; b < num_buckets; b++)
+         total += hist[b];
+      if (total == 0)
+         continue;
+
+      for (double q : quantiles) {
+         uint64_t rank = (uint64_t) (q * total);
+         uint64_t seen = 0;
+         unsigned int b = 0;
+         while ((b < num_buckets - 1) && (seen + hist[b] <= rank))
+            seen += hist[b++];
+
+         char line[256];
+         snprintf(line, sizeof(line),
+                  "tcpserver_stage_quantile_seconds{stage=\"%s\",quantile=\"%g\"} %.9g\n",
+                  stage_names[s], q, (double) bucketLow(b + 1) / 1e9);
+         out += line;
+      }
+   }
+}
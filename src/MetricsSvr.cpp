@@ -0,0 +1,119 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include "MetricsSvr.h"
+#include "Metrics.h"
+
+// How long a scraper gets to send its request, and to take the reply
+const int scrape_timeout_ms = 1000;
+
+// Longest request read; the rest is ignored
+const size_t max_request = 4096;
+
+MetricsSvr::MetricsSvr() {
+
+}
+
+/**********************************************************************************************
+ * ~MetricsSvr - shutting the listener down makes the blocked accept fail, which ends the
+ *               serving thread
+ **********************************************************************************************/
+
+MetricsSvr::~MetricsSvr() {
+   if (_thread.joinable()) {
+      ::shutdown(_sockfd.getFD(), SHUT_RDWR);
+      _thread.join();
+   }
+}
+
+/**********************************************************************************************
+ * bindSvr - binds and listens on the admin address
+ *
+ *    Throws: socket_error if the address could not be bound
+ **********************************************************************************************/
+
+void MetricsSvr::bindSvr(const char *ip_addr, unsigned short port) {
+   int one = 1;
+   setsockopt(_sockfd.getFD(), SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+   _sockfd.bindFD(ip_addr, port);
+   _sockfd.listenFD();
+}
+
+void MetricsSvr::start() {
+   _thread = std::thread(&MetricsSvr::serveLoop, this);
+}
+
+/**********************************************************************************************
+ * serveLoop - accepts and answers scrapes one at a time until the listener is shut down
+ **********************************************************************************************/
+
+void MetricsSvr::serveLoop() {
+   sockaddr_in peer;
+   while (true) {
+      int fd = _sockfd.acceptRaw(peer);
+      if (fd == -1) {
+         if ((errno == EINTR) || (errno == ECONNABORTED) || (errno == EAGAIN))
+            continue;
+         if (errno != EINVAL)
+            std::cerr << "Metrics endpoint stopped: " << strerror(errno) << "\n";
+         return;
+      }
+
+      serveClient(fd);
+      close(fd);
+   }
+}
+
+/**********************************************************************************************
+ * serveClient - reads the request head, or waits out the timeout for a client that sends
+ *               none, and writes the metrics back. Anything other than a GET gets a 405.
+ *
+ *    Params:  fd - the accepted (non-blocking) socket, closed by the caller
+ **********************************************************************************************/
+
+void MetricsSvr::serveClient(int fd) {
+   std::string request;
+   char buf[1024];
+   pollfd pfd = {fd, POLLIN, 0};
+
+   while ((request.size() < max_request) && (request.find("\r\n\r\n") == std::string::npos) &&
+          (request.find("\n\n") == std::string::npos)) {
+      if (poll(&pfd, 1, scrape_timeout_ms) <= 0)
+         break;
+      ssize_t results = recv(fd, buf, sizeof(buf), 0);
+      if (results <= 0)
+         break;
+      request.append(buf, results);
+   }
+
+   std::string body, reply;
+   if (request.empty() || (request.compare(0, 4, "GET ") == 0)) {
+      Metrics::render(body);
+      reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n";
+   } else {
+      body = "Only GET is supported\n";
+      reply = "HTTP/1.0 405 Method Not Allowed\r\nContent-Type: text/plain\r\n";
+   }
+   reply += "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n";
+   reply += body;
+
+   size_t sent = 0;
+   pfd.events = POLLOUT;
+   while (sent < reply.size()) {
+      ssize_t results = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+      if (results > 0) {
+         sent += results;
+         continue;
+      }
+      if ((results < 0) && (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR))
+         return;
+      if (poll(&pfd, 1, scrape_timeout_ms) <= 0)
+         return;
+   }
+}
@@ -0,0 +1,139 @@
+#include <sys/uio.h>
+#include <errno.h>
+#include <cstring>
+#include <algorithm>
+#include "OutQueue.h"
+
+// Copied text is coalesced into chunks of this size
+const size_t out_chunk_size = 4096;
+
+// Most fragments handed to a single writev
+const int out_max_iov = 64;
+
+/*****************************************************************************************
+ * reserve - checks that len more bytes fit under the hard limit
+ *****************************************************************************************/
+
+bool OutQueue::reserve(size_t len) {
+   if (_bytes + len > out_queue_hard_limit)
+      return false;
+   _bytes += len;
+   return true;
+}
+
+/*****************************************************************************************
+ * pushStatic - queues a pointer to data that stays valid for the life of the program
+ *
+ *    Returns: false if the queue is over its hard limit (nothing is queued)
+ *****************************************************************************************/
+
+bool OutQueue::pushStatic(const char *data, size_t len) {
+   if (len == 0)
+      return true;
+
+   // Keep the last slot for a chunk, so a full ring always ends in one that can grow
+   if (_nfrags >= out_max_frags - 1)
+      return pushCopy(data, len);
+
+   if (!reserve(len))
+      return false;
+
+   _nfrags++;
+   back().data = data;
+   back().len = len;
+   return true;
+}
+
+/*****************************************************************************************
+ * pushCopy - copies data onto the end of the last chunk if it fits, otherwise into a new
+ *            chunk. Once the ring is full the last chunk just grows.
+ *
+ *    Returns: false if the queue is over its hard limit (nothing is queued)
+ *****************************************************************************************/
+
+bool OutQueue::pushCopy(const char *data, size_t len) {
+   if (len == 0)
+      return true;
+   if (!reserve(len))
+      return false;
+
+   if ((_nfrags < out_max_frags) && ((_nfrags == 0) || (back().data != NULL) ||
+                                     (back().len + len > out_chunk_size))) {
+      _nfrags++;
+      back().data = NULL;
+      back().len = 0;
+      back().buf.reserve(std::max(len, out_chunk_size));
+   }
+
+   Fragment &chunk = back();
+   chunk.buf.append(data, len);
+   chunk.len += len;
+   return true;
+}
+
+/*****************************************************************************************
+ * flush - writes queued fragments with writev until the queue is empty or the FD would
+ *         block
+ *
+ *    Params:  fd - a non-blocking FD to write to
+ *
+ *    Returns: false on a write error (the connection should be dropped), true otherwise
+ *****************************************************************************************/
+
+bool OutQueue::flush(FileDesc &fd) {
+   iovec iov[out_max_iov];
+
+   while (_nfrags > 0) {
+      int n = 0;
+      for (; ((unsigned int) n < _nfrags) && (n < out_max_iov); n++) {
+         Fragment &f = frag(n);
+         const char *data = (f.data != NULL) ? f.data : f.buf.data();
+         size_t skip = (n == 0) ? _front_off : 0;
+         iov[n].iov_base = (void *) (data + skip);
+         iov[n].iov_len = f.len - skip;
+      }
+
+      ssize_t written = fd.writevFD(iov, n);
+      if (written < 0) {
+         if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return true;
+         if (errno == EINTR)
+            continue;
+         return false;
+      }
+
+      // Drop whatever went out completely and remember how far into the next one we got
+      _bytes -= written;
+      size_t left = written + _front_off;
+      while ((_nfrags > 0) && (left >= frag(0).len)) {
+         left -= frag(0).len;
+         popFront();
+      }
+      _front_off = left;
+   }
+   return true;
+}
+
+/*****************************************************************************************
+ * clear - drops everything queued
+ *****************************************************************************************/
+
+void OutQueue::clear() {
+   while (_nfrags > 0)
+      popFront();
+   _head = 0;
+   _front_off = 0;
+   _bytes = 0;
+}
+
+/*****************************************************************************************
+ * popFront - drops the first fragment, freeing its chunk if it had one
+ *****************************************************************************************/
+
+void OutQueue::popFront() {
+   Fragment &f = frag(0);
+   if (f.data == NULL)
+      std::string().swap(f.buf);
+   _head = (_head + 1) % out_max_frags;
+   _nfrags--;
+}
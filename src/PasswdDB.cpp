@@ -0,0 +1,322 @@
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <cstring>
+#include <cstddef>
+#include <algorithm>
+#include "PasswdDB.h"
+
+const char pwdb_magic[4] = {'P', 'W', 'D', 'B'};
+const uint32_t pwdb_version = 2;
+
+// Version 1 files, without hash parameters, are still read
+const uint32_t pwdb_v1 = 1;
+const size_t pwdb_v1_record_size = 80;
+
+PasswdDB::PasswdDB() {
+
+}
+
+PasswdDB::~PasswdDB() {
+   closeDB();
+}
+
+/*****************************************************************************************************
+ * openDB - maps a binary password file read-only and checks that its header and sections are sane
+ *
+ *    Params:  filename - the password file
+ *
+ *    Returns: true if the file is mapped, false if it is not a binary password file (e.g. the
+ *             legacy text format, even if it happens to start with the magic)
+ *
+ *    Throws: pwfile_error if the file could not be opened or is a corrupt binary file
+ *****************************************************************************************************/
+
+bool PasswdDB::openDB(const char *filename) {
+   closeDB();
+
+   int fd;
+   if ((fd = open(filename, O_RDONLY | O_CLOEXEC)) == -1)
+      throw pwfile_error("Could not open passwd file for reading");
+
+   struct stat st;
+   char magic[sizeof(pwdb_magic)];
+   if ((fstat(fd, &st) == -1) || ((size_t) st.st_size < sizeof(Header)) ||
+       (pread(fd, magic, sizeof(magic), 0) != sizeof(magic)) ||
+       (memcmp(magic, pwdb_magic, sizeof(magic)) != 0)) {
+      close(fd);
+      return false;
+   }
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED)
+      throw pwfile_error("Could not map passwd file");
+
+   _map = (const uint8_t *) map;
+   _maplen = st.st_size;
+   _header = (const Header *) _map;
+
+   // A text file whose first username starts with the magic has the rest of the name and
+   // its hash where the version goes, which won't match a version we write, so it is text
+   const Header &hdr = *_header;
+   if ((hdr.version != pwdb_v1) && (hdr.version != pwdb_version)) {
+      closeDB();
+      return false;
+   }
+
+   // Make sure every section the header points to is inside the file
+   bool v1 = (hdr.version == pwdb_v1) && (hdr.record_size == pwdb_v1_record_size);
+   bool v2 = (hdr.version == pwdb_version) && (hdr.record_size == sizeof(Record));
+   if ((!v1 && !v2) || (hdr.records_off % alignof(Record) != 0) ||
+       (hdr.index_slots == 0) || ((hdr.index_slots & (hdr.index_slots - 1)) != 0) ||
+       (hdr.records_off + (uint64_t) hdr.num_records * hdr.record_size > _maplen) ||
+       (hdr.index_off + (uint64_t) hdr.index_slots * sizeof(uint32_t) > _maplen)) {
+      closeDB();
+      throw pwfile_error("Binary passwd file is corrupt");
+   }
+
+   _records = _map + hdr.records_off;
+   _index = (const uint32_t *) (_map + hdr.index_off);
+   return true;
+}
+
+void PasswdDB::closeDB() {
+   if (_map != NULL)
+      munmap((void *) _map, _maplen);
+
+   _map = NULL;
+   _maplen = 0;
+   _header = NULL;
+   _records = NULL;
+   _index = NULL;
+}
+
+/*****************************************************************************************************
+ * findRecord - probes the on-disk index for the user
+ *
+ *    Returns: the record number, or -1 if the user is not in the file
+ *****************************************************************************************************/
+
+long PasswdDB::findRecord(const char *name) const {
+   if (_map == NULL)
+      return -1;
+
+   size_t len = strlen(name);
+   if (len >= pwdb_namelen)
+      return -1;
+
+   uint32_t mask = _header->index_slots - 1;
+   uint32_t slot = hashName(name, len) & mask;
+
+   // The index is at most half full, so an empty slot always ends the probe
+   for (uint32_t probes = 0; probes <= mask; probes++) {
+      uint32_t entry = _index[slot];
+      if (entry == 0)
+         return -1;
+
+      if ((entry <= _header->num_records) &&
+          (strncmp(record(entry - 1).name, name, pwdb_namelen) == 0))
+         return entry - 1;
+
+      slot = (slot + 1) & mask;
+   }
+   return -1;
+}
+
+bool PasswdDB::findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt,
+                                                                      HashParams &params) const {
+   long recnum = findRecord(name);
+   if (recnum < 0) {
+      hash.clear();
+      salt.clear();
+      return false;
+   }
+
+   const Record &rec = record(recnum);
+   hash.assign(rec.hash, rec.hash + pwdb_hashlen);
+   salt.assign(rec.salt, rec.salt + pwdb_saltlen);
+   getParams(rec, params);
+   return true;
+}
+
+/*****************************************************************************************************
+ * maxMemCost - the most memory (KiB) verifying any record in the file takes. writeDB keeps it in
+ *              the header; every version 1 record uses legacy_params.
+ *****************************************************************************************************/
+
+uint32_t PasswdDB::maxMemCost() const {
+   if ((_map == NULL) || (_header->num_records == 0))
+      return 0;
+
+   return (_header->version == pwdb_v1) ? legacy_params.m_cost : _header->max_m_cost;
+}
+
+/*****************************************************************************************************
+ * getParams - the hash parameters of a record, legacy_params for a version 1 file
+ *****************************************************************************************************/
+
+void PasswdDB::getParams(const Record &rec, HashParams &params) const {
+   if (_header->version == pwdb_v1) {
+      params = legacy_params;
+      return;
+   }
+
+   params.variant = rec.variant;
+   params.t_cost = rec.t_cost;
+   params.m_cost = rec.m_cost;
+   params.lanes = rec.lanes;
+}
+
+size_t PasswdDB::numUsers() const {
+   return (_map == NULL) ? 0 : _header->num_records;
+}
+
+void PasswdDB::getEntry(size_t recnum, Entry &entry) const {
+   const Record &rec = record(recnum);
+   entry.name.assign(rec.name, strnlen(rec.name, pwdb_namelen));
+   entry.hash.assign(rec.hash, rec.hash + pwdb_hashlen);
+   entry.salt.assign(rec.salt, rec.salt + pwdb_saltlen);
+   getParams(rec, entry.params);
+}
+
+/*****************************************************************************************************
+ * writeDB - builds a complete binary password file and replaces the target with it (see
+ *           replaceFile)
+ *
+ *    Params:  filename - the password file to replace
+ *             users - the users to write, first entry for a name wins
+ *
+ *    Throws: pwfile_error if a name is too long or the file could not be written
+ *****************************************************************************************************/
+
+void PasswdDB::writeDB(const char *filename, const std::vector<Entry> &users) {
+   Header hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   memcpy(hdr.magic, pwdb_magic, sizeof(pwdb_magic));
+   hdr.version = pwdb_version;
+   hdr.record_size = sizeof(Record);
+   hdr.index_slots = indexSlots(users.size());
+   hdr.records_off = sizeof(Header);
+
+   std::vector<Record> records;
+   std::vector<uint32_t> index(hdr.index_slots, 0);
+   uint32_t mask = hdr.index_slots - 1;
+   records.reserve(users.size());
+
+   for (const Entry &user : users) {
+      if ((user.name.size() >= pwdb_namelen) || (user.hash.size() != pwdb_hashlen) ||
+          (user.salt.size() != pwdb_saltlen))
+         throw pwfile_error("User entry does not fit the binary passwd format: " + user.name);
+
+      // Find the name's slot, skipping duplicates
+      uint32_t slot = hashName(user.name.c_str(), user.name.size()) & mask;
+      bool dup = false;
+      while (index[slot] != 0) {
+         if (strncmp(records[index[slot] - 1].name, user.name.c_str(), pwdb_namelen) == 0) {
+            dup = true;
+            break;
+         }
+         slot = (slot + 1) & mask;
+      }
+      if (dup)
+         continue;
+
+      Record rec;
+      memset(&rec, 0, sizeof(rec));
+      memcpy(rec.name, user.name.data(), user.name.size());
+      memcpy(rec.hash, user.hash.data(), pwdb_hashlen);
+      memcpy(rec.salt, user.salt.data(), pwdb_saltlen);
+      rec.m_cost = user.params.m_cost;
+      rec.t_cost = user.params.t_cost;
+      rec.lanes = user.params.lanes;
+      rec.variant = user.params.variant;
+      records.push_back(rec);
+      index[slot] = records.size();
+      hdr.max_m_cost = std::max(hdr.max_m_cost, rec.m_cost);
+   }
+
+   hdr.num_records = records.size();
+   hdr.index_off = hdr.records_off + records.size() * sizeof(Record);
+
+   std::string data;
+   data.reserve(sizeof(hdr) + records.size() * sizeof(Record) + index.size() * sizeof(uint32_t));
+   data.append((const char *) &hdr, sizeof(hdr));
+   data.append((const char *) records.data(), records.size() * sizeof(Record));
+   data.append((const char *) index.data(), index.size() * sizeof(uint32_t));
+
+   replaceFile(filename, data);
+}
+
+/*****************************************************************************************************
+ * replaceFile - replaces a file's contents crash-safely: the data goes to a temporary file next to
+ *               it, which is synced and renamed over the original, and then the directory is
+ *               synced so the rename itself survives a crash. Readers and a crash at any point see
+ *               either the old file or the new one, never a mix.
+ *
+ *    Params:  filename - the file to replace
+ *             data - its new contents
+ *
+ *    Throws: pwfile_error if the file could not be written
+ *****************************************************************************************************/
+
+void PasswdDB::replaceFile(const char *filename, const std::string &data) {
+   std::string tmpname = std::string(filename) + ".tmp";
+   int fd;
+   if ((fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600)) == -1)
+      throw pwfile_error("Could not open passwd file for writing");
+
+   size_t written = 0;
+   while (written < data.size()) {
+      ssize_t results = write(fd, data.data() + written, data.size() - written);
+      if (results <= 0)
+         break;
+      written += results;
+   }
+
+   if ((written != data.size()) || (fsync(fd) == -1)) {
+      close(fd);
+      unlink(tmpname.c_str());
+      throw pwfile_error("Could not write passwd file");
+   }
+   close(fd);
+
+   if (rename(tmpname.c_str(), filename) == -1) {
+      unlink(tmpname.c_str());
+      throw pwfile_error("Could not replace passwd file");
+   }
+
+   std::string dirname(filename);
+   size_t slash = dirname.rfind('/');
+   dirname = (slash == std::string::npos) ? "." : dirname.substr(0, slash + 1);
+   if ((fd = open(dirname.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC)) != -1) {
+      fsync(fd);
+      close(fd);
+   }
+}
+
+/*****************************************************************************************************
+ * hashName - 64-bit FNV-1a of the username, used to place it in the index
+ *****************************************************************************************************/
+
+uint64_t PasswdDB::hashName(const char *name, size_t len) {
+   uint64_t h = 14695981039346656037ULL;
+   for (size_t i = 0; i < len; i++) {
+      h ^= (uint8_t) name[i];
+      h *= 1099511628211ULL;
+   }
+   return h;
+}
+
+/*****************************************************************************************************
+ * indexSlots - power of two index size that keeps the table at most half full
+ *****************************************************************************************************/
+
+uint32_t PasswdDB::indexSlots(size_t num_records) {
+   uint32_t slots = 8;
+   while (slots < num_records * 2)
+      slots <<= 1;
+   return slots;
+}
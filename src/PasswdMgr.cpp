@@ -1,24 +1,45 @@
 #include <argon2.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <strings.h>
 #include <iostream>
 #include <algorithm>
 #include <cstring>
 #include <list>
+#include <unordered_set>
 #include "PasswdMgr.h"
 #include "FileDesc.h"
 #include "strfuncts.h"
+#include "Metrics.h"
 #include <random>
 #include <cstdlib>
 #include <ctime>
 #include <array>
-#include <fstream>
+#include <chrono>
+#include <thread>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+#include <sys/random.h>
 
 const int hashlen = 32;
 const int saltlen = 16;
 
-PasswdMgr::PasswdMgr(const char *pwd_file):_pwd_file(pwd_file) {
+// Limits of the binary record fields and of argon2 itself
+const uint32_t max_t_cost = 0xffff;
+const uint32_t max_lanes = 0xff;
+const uint32_t min_m_cost_per_lane = 8;   // KiB
 
+// How often (ns) lookups check whether the password file changed on disk
+const int64_t reload_check_ns = 1000000000LL;
+
+static int64_t steadyNs() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+PasswdMgr::PasswdMgr(const char *pwd_file):_pwd_file(pwd_file), _next_check(0), _table_m_cost(0) {
+   bzero(&_loaded_stat, sizeof(_loaded_stat));
 }
 
 
@@ -35,8 +56,9 @@ PasswdMgr::~PasswdMgr() {
 
 bool PasswdMgr::checkUser(const char *name) {
    std::vector<uint8_t> passwd, salt;
+   HashParams params;
 
-   bool result = findUser(name, passwd, salt);
+   bool result = findUser(name, passwd, salt, params);
 
    return result;
      
@@ -44,7 +66,8 @@ bool PasswdMgr::checkUser(const char *name) {
 
 /*******************************************************************************************
  * checkPasswd - Checks the password for a given user to see if it matches the password
- *               in the passwd file
+ *               in the passwd file, hashing with the parameters the user's hash was made
+ *               with. A match against out-of-date parameters is rehashed (see rehashUser).
  *
  *    Params:  name - username string to check (case insensitive)
  *             passwd - password string to hash and compare (case sensitive)
@@ -59,24 +82,201 @@ bool PasswdMgr::checkPasswd(const char *name, const char *passwd) {
    std::vector<uint8_t> userhash; // hash read from the password file
    std::vector<uint8_t> passhash; // new hash to be generated from entered passwrd
    std::vector<uint8_t> salt; //salt read from the password file
+   HashParams params;         //what the stored hash was made with
 
    // Check if the user exists and get the hashed password / salt
-   if (!findUser(name, userhash, salt))
+   if (!findUser(name, userhash, salt, params))
       return false;
 
+   // Verified against these same stored credentials moments ago
+   if (_auth_cache && _auth_cache->lookup(name, passwd, userhash, salt)) {
+      Metrics::count(Metrics::ctr_auth_cache_hits);
+      return true;
+   }
+
    //Hash the entered password using the salt
-   hashArgon2(passhash, salt, passwd, &salt);
+   {
+      Metrics::Timer timer(Metrics::stage_argon2);
+      hashArgon2(passhash, salt, passwd, params);
+   }
 
    //Compare the two hash values
-   if (userhash == passhash) {
-      return true;
+   if (userhash != passhash)
+      return false;
+
+   if (params != _params)
+      rehashUser(name, passwd, userhash);
+   else if (_auth_cache)
+      _auth_cache->insert(name, passwd, userhash, salt);
+   return true;
+}
+
+/*******************************************************************************************
+ * rehashUser - replaces a hash made with old parameters by one made with the current
+ *              parameters, now that the password is known. The change only applies if the
+ *              stored hash is still the one just verified, so a password changed meanwhile
+ *              is never overwritten. Failures are reported but don't fail the login; the
+ *              next login tries again.
+ *******************************************************************************************/
+
+void PasswdMgr::rehashUser(const char *name, const char *passwd,
+                                             const std::vector<uint8_t> &old_hash) {
+   Update update;
+   update.add = false;
+   update.old_hash = old_hash;
+   update.entry.name = name;
+   update.entry.params = _params;
+
+   try {
+      generateSalt(update.entry.salt);
+      hashArgon2(update.entry.hash, update.entry.salt, passwd, _params);
+      commitUpdate(update);
+   } catch (pwfile_error &e) {
+      std::cerr << "Could not rehash the password of " << name << ": " << e.what() << std::endl;
    }
+}
 
-   return false;
+/*******************************************************************************************
+ * setHashParams - sets the parameters new and rehashed passwords are hashed with
+ *******************************************************************************************/
+
+void PasswdMgr::setHashParams(const HashParams &params) {
+   _params = params;
+}
+
+/*******************************************************************************************
+ * parseHashParams - reads a "<variant>:<t_cost>:<m_cost>:<lanes>" spec, e.g. "id:3:262144:0"
+ *
+ *    Params:  spec - the spec. variant is i, d or id (an "argon2" prefix is allowed), m_cost
+ *                    is in KiB and lanes 0 means one per core.
+ *             params - set from the spec if it is valid
+ *
+ *    Returns: false if the spec is malformed or a value is out of range
+ *******************************************************************************************/
+
+bool PasswdMgr::parseHashParams(const char *spec, HashParams &params) {
+   const char *colon = strchr(spec, ':');
+   if (colon == NULL)
+      return false;
+
+   std::string variant(spec, colon - spec);
+   if (strncasecmp(variant.c_str(), "argon2", 6) == 0)
+      variant.erase(0, 6);
+
+   HashParams parsed;
+   if (strcasecmp(variant.c_str(), "i") == 0)
+      parsed.variant = HashParams::argon2i;
+   else if (strcasecmp(variant.c_str(), "d") == 0)
+      parsed.variant = HashParams::argon2d;
+   else if (strcasecmp(variant.c_str(), "id") == 0)
+      parsed.variant = HashParams::argon2id;
+   else
+      return false;
+
+   unsigned long values[3];
+   const char *pos = colon + 1;
+   for (int i = 0; i < 3; i++) {
+      char *end;
+      errno = 0;
+      values[i] = strtoul(pos, &end, 10);
+      if ((end == pos) || (errno != 0) || (*end != ((i < 2) ? ':' : '\0')))
+         return false;
+      pos = end + 1;
+   }
+
+   if (values[2] == 0)
+      values[2] = std::max(1U, std::thread::hardware_concurrency());
+   values[2] = std::min<unsigned long>(values[2], max_lanes);
+
+   if ((values[0] < 1) || (values[0] > max_t_cost) ||
+       (values[1] < min_m_cost_per_lane * values[2]) || (values[1] > 0xffffffffUL))
+      return false;
+
+   parsed.t_cost = values[0];
+   parsed.m_cost = values[1];
+   parsed.lanes = values[2];
+   params = parsed;
+   return true;
+}
+
+/*******************************************************************************************
+ * setAuthCache - turns on caching of successful password checks
+ *
+ *    Params:  ttl_secs - how long a check is remembered (0 turns caching off)
+ *             max_entries - hard cap on the cache size, AuthCache::entry_bytes each. At
+ *                           least AuthCache::ways (one bucket).
+ *******************************************************************************************/
+
+void PasswdMgr::setAuthCache(unsigned int ttl_secs, size_t max_entries) {
+   if (ttl_secs == 0)
+      _auth_cache.reset();
+   else
+      _auth_cache.reset(new AuthCache(ttl_secs, max_entries));
+}
+
+/*******************************************************************************************
+ * checkPasswdAsync - Same check as checkPasswd, but the file lookup and argon2 hash run on
+ *                    a hash pool thread so the caller's event loop is never blocked.
+ *
+ *    Params:  name, passwd - as for checkPasswd, copied before this returns
+ *             pool - the pool to run the check on
+ *             done - called with the result on the pool thread. Password file errors are
+ *                    reported and treated as a failed check.
+ *
+ *******************************************************************************************/
+
+void PasswdMgr::checkPasswdAsync(const char *name, const char *passwd, HashPool &pool,
+                                                         std::function<void(bool)> done) {
+   std::string uname(name), pwd(passwd);
+
+   pool.submit([this, uname, pwd, done]() {
+      bool result = false;
+      try {
+         result = checkPasswd(uname.c_str(), pwd.c_str());
+      } catch (pwfile_error &e) {
+         std::cerr << "Error with the password file: " << e.what() << std::endl;
+      }
+      done(result);
+   });
+}
+
+/*******************************************************************************************
+ * hashMemBytes - memory used by the costliest argon2 hash we may run (m_cost is KiB). Every
+ *                record verifies with its own parameters, so this covers the biggest one in
+ *                the table as well as the parameters new hashes are made with.
+ *******************************************************************************************/
+
+size_t PasswdMgr::hashMemBytes() const {
+   return (size_t) std::max(_params.m_cost, _table_m_cost.load(std::memory_order_relaxed)) * 1024;
+}
+
+/*******************************************************************************************
+ * useHashPool - hands table reloads to the pool and caps its concurrent hashes for the
+ *               current table now, and again on every reload, so a record with a larger
+ *               m_cost can't push the pool over mem_cap. The table is loaded here so the
+ *               first lookups don't wait for it. A missing file is not an error here; the
+ *               cap is set once it loads.
+ *******************************************************************************************/
+
+void PasswdMgr::useHashPool(HashPool &pool, size_t mem_cap) {
+   {
+      std::lock_guard<std::mutex> lock(_reload_mutex);
+      _pool = &pool;
+      _pool_mem_cap = mem_cap;
+      pool.setLimit(HashPool::threadsForCap(mem_cap, hashMemBytes()));
+   }
+
+   try {
+      getTable();
+   } catch (pwfile_error &e) {
+      // Checked again on the first lookup
+   }
 }
 
 /*******************************************************************************************
- * changePasswd - Changes the password for the given user to the password string given
+ * changePasswd - Changes the password for the given user to the password string given. The
+ *                hash is computed first, then the change is committed with any others
+ *                waiting (see commitUpdate).
  *
  *    Params:  name - username string to change (case insensitive)
  *             passwd - the new password (case sensitive)
@@ -89,126 +289,253 @@ bool PasswdMgr::checkPasswd(const char *name, const char *passwd) {
  *******************************************************************************************/
 
 bool PasswdMgr::changePasswd(const char *name, const char *passwd) {
-   //Need to overwrite the entry in the passwd file using a randomly generated 16byte hash and the provided username/passwd
-   std::vector<uint8_t> passhash; // buffer to store the new hash
-   std::vector<uint8_t> salt; //buffer to store the new salt
+   Update update;
+   update.add = false;
+   update.entry.name = name;
+   update.entry.params = _params;
 
    //Generate Salt
-   generateSalt(salt);
+   generateSalt(update.entry.salt);
 
    //Hash the salt + password
-   hashArgon2(passhash, salt, passwd, &salt);
+   hashArgon2(update.entry.hash, update.entry.salt, passwd, _params);
 
-   //Open the password file
-   std::fstream pwfile(_pwd_file, std::ios::out | std::ios::in | std::ios::binary);
-   if (!pwfile)
-      throw pwfile_error("Could not open passwd file for reading");
+   bool changed = commitUpdate(update);
+
+   // The old password must stop working now, not when its entry expires
+   if (_auth_cache)
+      _auth_cache->invalidate(name);
+   return changed;
+}
 
-   //move to the proper location
-   std::string line;
-   while (line != name) {
-      getline(pwfile, line);
+/*******************************************************************************************
+ * changePasswdAsync - Same as changePasswd, but the hash and the commit that waits on the
+ *                     disk run on a hash pool thread so the caller's event loop keeps going.
+ *
+ *    Params:  name, passwd - as for changePasswd, copied before this returns
+ *             pool - the pool to run the change on
+ *             done - called with the result on the pool thread. Password file errors are
+ *                    reported and treated as a failed change.
+ *
+ *******************************************************************************************/
+
+void PasswdMgr::changePasswdAsync(const char *name, const char *passwd, HashPool &pool,
+                                                          std::function<void(bool)> done) {
+   std::string uname(name), pwd(passwd);
+
+   pool.submit([this, uname, pwd, done]() mutable {
+      bool result = false;
+      try {
+         result = changePasswd(uname.c_str(), pwd.c_str());
+      } catch (pwfile_error &e) {
+         std::cerr << "Error with the password file: " << e.what() << std::endl;
+      }
+      std::fill(pwd.begin(), pwd.end(), '\0');
+      done(result);
+   });
+}
+
+/*****************************************************************************************************
+ * commitUpdate - queues a change and waits until it is on disk. If no commit is running, this
+ *                thread runs one for everything queued (group commit); otherwise it waits for the
+ *                running commit to finish and the next one to take its change. Either way, many
+ *                concurrent changes cost one lock, read, write and fsync between them.
+ *
+ *    Returns: whether the change applied (the user existed for a password change, or didn't for
+ *             a new user)
+ *
+ *    Throws: pwfile_error if the commit that carried the change failed
+ *****************************************************************************************************/
+
+bool PasswdMgr::commitUpdate(Update &update) {
+   std::unique_lock<std::mutex> lock(_commit_mutex);
+   _commit_queue.push_back(&update);
+
+   while (!update.done) {
+      if (_committing) {
+         _commit_cv.wait(lock);
+         continue;
+      }
+
+      // Lead a commit of everything queued so far, ours included
+      std::vector<Update *> batch;
+      batch.swap(_commit_queue);
+      _committing = true;
+      lock.unlock();
+
+      std::string error;
+      try {
+         commitBatch(batch);
+      } catch (pwfile_error &e) {
+         error = e.what();
+      }
+
+      lock.lock();
+      for (Update *queued : batch) {
+         queued->error = error;
+         queued->done = true;
+      }
+      _committing = false;
+      _commit_cv.notify_all();
    }
 
-   //Build the data to write
-   uint8_t test[hashlen];
-   uint8_t outSalt[saltlen];
-   
-   int p = 0;
-   for (auto i = passhash.begin(); i != passhash.end(); ++i) {
-      test[p] = *i;
-      p++;
+   if (!update.error.empty())
+      throw pwfile_error(update.error);
+   return update.result;
+}
+
+/*****************************************************************************************************
+ * FileLock - holds an exclusive flock on a lock file for as long as it is in scope. A separate lock
+ *            file is used since the password file itself is replaced by every commit.
+ *****************************************************************************************************/
+
+class FileLock {
+public:
+   FileLock(const std::string &filename) {
+      if ((_fd = open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0600)) == -1)
+         throw pwfile_error("Could not open passwd lock file");
+
+      while (flock(_fd, LOCK_EX) == -1) {
+         if (errno != EINTR) {
+            close(_fd);
+            throw pwfile_error("Could not lock passwd file");
+         }
+      }
    }
 
-   p = 0;
-   for (auto i = salt.begin(); i != salt.end(); ++i) {
-      outSalt[p] = *i;
-      p++;
+   ~FileLock() {
+      flock(_fd, LOCK_UN);
+      close(_fd);
    }
 
-   //Overwrite the hash and salt
-   pwfile.write((char*) test, hashlen);
-   pwfile.write((char*) outSalt, saltlen);
-   pwfile.write("\n", 1);
+private:
+   int _fd;
+};
 
-   //Close the file after writing
-   pwfile.close();
+/*****************************************************************************************************
+ * commitBatch - applies a batch of changes to the password file under the file lock. The file is
+ *               read fresh rather than taken from the table, which may be up to a second stale or
+ *               miss another process's change. Nothing is written if no change applied.
+ *
+ *    Params:  batch - the changes, each of which gets its result set
+ *
+ *    Throws: pwfile_error if the file could not be locked, read or written
+ *****************************************************************************************************/
 
-   return true;
+void PasswdMgr::commitBatch(std::vector<Update *> &batch) {
+   FileLock lock(_pwd_file + ".lock");
+
+   std::vector<PasswdDB::Entry> entries;
+   bool binary = loadEntries(entries);
+
+   std::unordered_map<std::string, size_t> names;
+   for (size_t i = 0; i < entries.size(); i++)
+      names.emplace(entries[i].name, i);
+
+   bool changed = false;
+   for (Update *update : batch) {
+      auto user = names.find(update->entry.name);
+
+      if (update->add) {
+         update->result = (user == names.end());
+         if (update->result) {
+            names.emplace(update->entry.name, entries.size());
+            entries.push_back(update->entry);
+         }
+      } else {
+         update->result = (user != names.end()) &&
+                      (update->old_hash.empty() || (entries[user->second].hash == update->old_hash));
+         if (update->result) {
+            entries[user->second].hash = update->entry.hash;
+            entries[user->second].salt = update->entry.salt;
+            entries[user->second].params = update->entry.params;
+         }
+      }
+      changed |= update->result;
+   }
+
+   if (changed)
+      storeEntries(entries, binary);
+   tableWritten();
 }
 
 /*****************************************************************************************************
- * readUser - Taking in an opened File Descriptor of the password file, reads in a user entry and
- *            loads the passed in variables
+ * loadEntries - reads every user from the password file, in file order. A missing file is read as
+ *               an empty text file.
  *
- *    Params:  pwfile - FileDesc of password file already opened for reading
- *             name - std string to store the name read in
- *             hash, salt - vectors to store the read-in hash and salt respectively
+ *    Params:  entries - vector to store the users in
  *
- *    Returns: true if a new entry was read, false if eof reached 
- * 
- *    Throws: pwfile_error exception if the file appeared corrupted
+ *    Returns: true if the file is in the binary format
  *
+ *    Throws: pwfile_error if the file could not be read
  *****************************************************************************************************/
 
-bool PasswdMgr::readUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt)
-{
-   unsigned char newline;
-   ssize_t eof_check;
-   //Readline from the pwfile and write the value into the &name variable
-   //Should return 0 if it read EOF
-   if (!pwfile.readStr(name)) {
+bool PasswdMgr::loadEntries(std::vector<PasswdDB::Entry> &entries) {
+   entries.clear();
+
+   struct stat st;
+   if ((stat(_pwd_file.c_str(), &st) == -1) && (errno == ENOENT))
       return false;
+
+   PasswdDB db;
+   if (db.openDB(_pwd_file.c_str())) {
+      entries.resize(db.numUsers());
+      for (size_t i = 0; i < db.numUsers(); i++)
+         db.getEntry(i, entries[i]);
+      return true;
    }
-   if (pwfile.readBytes(hash, hashlen) < 0) { return false; }
-   if (pwfile.readBytes(salt, saltlen) < 0) { return false; }
-   if (pwfile.readByte(newline) < 0 ) { return false; }
-   return true;
+
+   FileFD pwfile(_pwd_file.c_str());
+   if (!pwfile.openFile(FileFD::readfd))
+      throw pwfile_error("Could not open passwd file for reading");
+
+   std::string data;
+   ssize_t results = pwfile.readAll(data);
+   pwfile.closeFD();
+   if (results < 0)
+      throw pwfile_error("Could not read passwd file");
+
+   parseUsers(data, entries);
+   return false;
 }
 
 /*****************************************************************************************************
- * writeUser - Taking in an opened File Descriptor of the password file, writes a user entry to disk
- *
- *    Params:  pwfile - FileDesc of password file already opened for writing
- *             name - std string of the name 
- *             hash, salt - vectors of the hash and salt to write to disk
- *
- *    Returns: bytes written
- *
- *    Throws: pwfile_error exception if the writes fail
+ * storeEntries - replaces the password file with the given users, in the binary format or the
+ *                legacy text format (username\n{32 byte hash}{16 byte salt}\n per user). The text
+ *                format has nowhere to keep hash parameters, so a file with any non-legacy hash is
+ *                always written binary.
  *
+ *    Throws: pwfile_error if the file could not be written
  *****************************************************************************************************/
 
-int PasswdMgr::writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt)
-{
-   int results = 0;
+void PasswdMgr::storeEntries(const std::vector<PasswdDB::Entry> &entries, bool binary) {
+   for (const PasswdDB::Entry &entry : entries)
+      binary |= (entry.params != legacy_params);
 
-   //Append a newline and write the name to the file
-   name += '\n';
-   pwfile.writeFD(name);
-   results += name.length();
-
-   //Write the hash and salt to the file
-   pwfile.writeBytes<uint8_t>(hash);
-   results += hash.size();
-   
-   pwfile.writeBytes<uint8_t>(salt);
-   results += salt.size();
-
-   //Add a terminating newline
-   pwfile.writeFD("\n");
-   results += 1;
+   if (binary) {
+      PasswdDB::writeDB(_pwd_file.c_str(), entries);
+      return;
+   }
 
-   return results;
+   std::string data;
+   for (const PasswdDB::Entry &entry : entries) {
+      data += entry.name;
+      data += '\n';
+      data.append(entry.hash.begin(), entry.hash.end());
+      data.append(entry.salt.begin(), entry.salt.end());
+      data += '\n';
+   }
+   PasswdDB::replaceFile(_pwd_file.c_str(), data);
 }
 
 /*****************************************************************************************************
- * findUser - Reads in the password file, finding the user (if they exist) and populating the two
- *            passed in vectors with their hash and salt
+ * findUser - Looks the user up in the in-memory table, populating the two passed in vectors with
+ *            their hash and salt if they exist
  *
  *    Params:  name - the username to search for
  *             hash - vector to store the user's password hash
  *             salt - vector to store the user's salt string
+ *             params - set to the parameters the hash was made with
  *
  *    Returns: true if found, false if not
  *
@@ -216,33 +543,227 @@ int PasswdMgr::writeUser(FileFD &pwfile, std::string &name, std::vector<uint8_t>
  *
  *****************************************************************************************************/
 
-bool PasswdMgr::findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt) {
-   FileFD pwfile(_pwd_file.c_str());
+bool PasswdMgr::findUser(const char *name, std::vector<uint8_t> &hash, std::vector<uint8_t> &salt,
+                                                                         HashParams &params) {
+   std::shared_ptr<const UserTable> table = getTable();
 
-   // You may need to change this code for your specific implementation
-   if (!pwfile.openFile(FileFD::readfd))
-      throw pwfile_error("Could not open passwd file for reading");
+   if (table->db.isOpen())
+      return table->db.findUser(name, hash, salt, params);
 
-   // Password file should be in the format username\n{32 byte hash}{16 byte salt}\n
-   bool eof = false;
-   while (!eof) {
-      std::string uname;
+   auto user = table->users.find(name);
+   if (user == table->users.end()) {
+      hash.clear();
+      salt.clear();
+      return false;
+   }
 
-      if (!readUser(pwfile, uname, hash, salt)) {
-         eof = true;
-         continue;
+   hash = user->second.hash;
+   salt = user->second.salt;
+   params = user->second.params;
+   return true;
+}
+
+/*****************************************************************************************************
+ * getTable - returns the current user table, first checking whether the password file changed. The
+ *            file is only stat'ed once per reload_check_ns, so most lookups make no syscalls.
+ *
+ *    Throws: pwfile_error exception if the pwfile could not be read
+ *
+ *****************************************************************************************************/
+
+std::shared_ptr<const PasswdMgr::UserTable> PasswdMgr::getTable() {
+   int64_t now = steadyNs();
+   if (now >= _next_check.load(std::memory_order_relaxed))
+      refreshTable(now);
+
+   return std::atomic_load(&_users);
+}
+
+/*****************************************************************************************************
+ * refreshTable - stats the password file and reloads the table if the file was replaced or its
+ *                size or modification time changed since it was loaded. Lookups come from the
+ *                event loops, so once a table is loaded and there is a pool, only the stat runs
+ *                here: the rebuild is queued on the pool and the current table is served until
+ *                the new one is published. The first load, or one without a pool, runs here.
+ *
+ *    Params:  now - steady clock time in ns, used to schedule the next check
+ *
+ *    Throws: pwfile_error exception if the pwfile could not be read
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::refreshTable(int64_t now) {
+   {
+      std::lock_guard<std::mutex> lock(_reload_mutex);
+
+      // Another thread got here first
+      if (now < _next_check.load(std::memory_order_relaxed))
+         return;
+
+      struct stat st;
+      if (stat(_pwd_file.c_str(), &st) == -1)
+         throw pwfile_error("Could not open passwd file for reading");
+
+      if (_users && (st.st_ino == _loaded_stat.st_ino) && (st.st_size == _loaded_stat.st_size) &&
+          (st.st_mtim.tv_sec == _loaded_stat.st_mtim.tv_sec) &&
+          (st.st_mtim.tv_nsec == _loaded_stat.st_mtim.tv_nsec)) {
+         _next_check.store(now + reload_check_ns, std::memory_order_relaxed);
+         return;
       }
 
-      if (!uname.compare(name)) {
-         pwfile.closeFD();
-         return true;
+      if (_users && (_pool != NULL)) {
+         _next_check.store(now + reload_check_ns, std::memory_order_relaxed);
+         if (!_reload_queued) {
+            _reload_queued = true;
+            _pool->submit([this]() {
+               try {
+                  reloadTable(false);
+               } catch (std::exception &e) {
+                  std::cerr << "Could not reload the passwd file: " << e.what() << std::endl;
+               }
+               std::lock_guard<std::mutex> lock(_reload_mutex);
+               _reload_queued = false;
+            });
+         }
+         return;
       }
    }
 
-   hash.clear();
-   salt.clear();
-   pwfile.closeFD();
-   return false;
+   reloadTable(false);
+}
+
+/*****************************************************************************************************
+ * reloadTable - builds a new table from the password file and publishes it. Binary files are just
+ *               mapped. Otherwise the whole file is read in one go and the table is built off to
+ *               the side. A failed reload leaves the current table in place, and it is tried again
+ *               on the next check.
+ *
+ *    Params:  force - reload even if the file looks the same as the one the table came from
+ *
+ *    Throws: pwfile_error exception if the pwfile could not be read
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::reloadTable(bool force) {
+   std::lock_guard<std::mutex> load_lock(_load_mutex);
+
+   struct stat st;
+   if (stat(_pwd_file.c_str(), &st) == -1)
+      throw pwfile_error("Could not open passwd file for reading");
+
+   // A reload that finished while this one waited may already have the file
+   if (!force) {
+      std::lock_guard<std::mutex> lock(_reload_mutex);
+      if (_users && (st.st_ino == _loaded_stat.st_ino) && (st.st_size == _loaded_stat.st_size) &&
+          (st.st_mtim.tv_sec == _loaded_stat.st_mtim.tv_sec) &&
+          (st.st_mtim.tv_nsec == _loaded_stat.st_mtim.tv_nsec))
+         return;
+   }
+
+   std::shared_ptr<UserTable> table = std::make_shared<UserTable>();
+   if (!table->db.openDB(_pwd_file.c_str())) {
+      FileFD pwfile(_pwd_file.c_str());
+      if (!pwfile.openFile(FileFD::readfd))
+         throw pwfile_error("Could not open passwd file for reading");
+
+      std::string data;
+      ssize_t results = pwfile.readAll(data);
+      pwfile.closeFD();
+      if (results < 0)
+         throw pwfile_error("Could not read passwd file");
+
+      // The first entry for a name wins, as it did when the file was scanned
+      std::vector<PasswdDB::Entry> entries;
+      parseUsers(data, entries);
+      for (PasswdDB::Entry &entry : entries) {
+         auto user = table->users.emplace(entry.name, UserRec());
+         if (user.second) {
+            user.first->second.hash.swap(entry.hash);
+            user.first->second.salt.swap(entry.salt);
+         }
+      }
+   }
+
+   publishTable(table, st);
+}
+
+/*****************************************************************************************************
+ * publishTable - makes a freshly built table the current one and re-caps the pool for its hashes
+ *
+ *    Params:  table - the new table
+ *             st - the file identity it was loaded from
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::publishTable(std::shared_ptr<UserTable> table, const struct stat &st) {
+   std::lock_guard<std::mutex> lock(_reload_mutex);
+
+   uint32_t max_cost = table->db.isOpen() ? table->db.maxMemCost() :
+                       (table->users.empty() ? 0 : legacy_params.m_cost);
+   _table_m_cost.store(max_cost, std::memory_order_relaxed);
+   if (_pool != NULL)
+      _pool->setLimit(HashPool::threadsForCap(_pool_mem_cap, hashMemBytes()));
+
+   std::atomic_store(&_users, std::shared_ptr<const UserTable>(table));
+   _loaded_stat = st;
+   _next_check.store(steadyNs() + reload_check_ns, std::memory_order_relaxed);
+}
+
+/*****************************************************************************************************
+ * parseUsers - reads the users out of raw password file contents. Entries are in the format
+ *              username\n{32 byte hash}{16 byte salt}\n. The hash and salt are taken by length
+ *              rather than searched for a newline since they are binary.
+ *
+ *    Params:  data - the password file contents
+ *             entries - vector to append the users to, in file order
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::parseUsers(const std::string &data, std::vector<PasswdDB::Entry> &entries) {
+   size_t pos = 0;
+
+   while (pos < data.size()) {
+      size_t nl = data.find('\n', pos);
+      if ((nl == std::string::npos) || (nl + 1 + hashlen + saltlen > data.size()))
+         break;
+
+      entries.emplace_back();
+      PasswdDB::Entry &entry = entries.back();
+      entry.name = data.substr(pos, nl - pos);
+
+      const uint8_t *rec = (const uint8_t *) data.data() + nl + 1;
+      entry.hash.assign(rec, rec + hashlen);
+      entry.salt.assign(rec + hashlen, rec + hashlen + saltlen);
+
+      // Skip the terminating newline
+      pos = nl + 1 + hashlen + saltlen + 1;
+   }
+}
+
+/*****************************************************************************************************
+ * tableWritten - called after we write the file ourselves. The size and timestamp may not have
+ *                changed, so the table is rebuilt now rather than left to the stat check. Writes
+ *                never run on an event loop, and rebuilding here means the change is visible to
+ *                lookups as soon as the write returns. Until a lookup loads a table there is
+ *                nothing to rebuild.
+ *
+ *****************************************************************************************************/
+
+void PasswdMgr::tableWritten() {
+   {
+      std::lock_guard<std::mutex> lock(_reload_mutex);
+      bzero(&_loaded_stat, sizeof(_loaded_stat));
+      _next_check.store(0, std::memory_order_relaxed);
+      if (!_users)
+         return;
+   }
+
+   try {
+      reloadTable(true);
+   } catch (pwfile_error &e) {
+      // The change is on disk; the next lookup loads it
+      std::cerr << "Could not reload the passwd file: " << e.what() << std::endl;
+   }
 }
 
 
@@ -250,90 +771,239 @@ bool PasswdMgr::findUser(const char *name, std::vector<uint8_t> &hash, std::vect
  * hashArgon2 - Performs a hash on the password using the Argon2 library. Implementation algorithm
  *              taken from the http://github.com/P-H-C/phc-winner-argon2 example. 
  *
- *    Params:  dest - the std string object to store the hash
+ *    Params:  ret_hash - the vector to store the hash
+ *             ret_salt - the salt to hash with
  *             passwd - the password to be hashed
+ *             params - variant and costs to hash with
  *
- *    Throws: runtime_error if the salt passed in is not the right size
+ *    Throws: pwfile_error if argon2 failed (out of memory or bad parameters)
  *****************************************************************************************************/
-void PasswdMgr::hashArgon2(std::vector<uint8_t> &ret_hash, std::vector<uint8_t> &ret_salt, 
-                           const char *in_passwd, std::vector<uint8_t> *in_salt) {
+
+void PasswdMgr::hashArgon2(std::vector<uint8_t> &ret_hash, const std::vector<uint8_t> &ret_salt,
+                           const char *in_passwd, const HashParams &params) {
    // Hash those passwords!!!!
     uint32_t pwdlen = strlen(in_passwd);
     uint8_t hash[hashlen];
     uint8_t salt[saltlen];
 
-    uint32_t t_cost = 2;            // 1-pass computation
-    uint32_t m_cost = (1<<16);      // 64 mebibytes memory usage
-    uint32_t parallelism = 1;       // number of threads and lanes
-
    for (int i = 0; i < saltlen; i++) {
       salt[i] = ret_salt[i];
    }
 
     // high-level API
-   argon2i_hash_raw(t_cost, m_cost, parallelism, in_passwd, pwdlen, salt, saltlen, hash, hashlen);
+   int results;
+   switch (params.variant) {
+      case HashParams::argon2d:
+         results = argon2d_hash_raw(params.t_cost, params.m_cost, params.lanes, in_passwd, pwdlen,
+                                                                   salt, saltlen, hash, hashlen);
+         break;
+      case HashParams::argon2id:
+         results = argon2id_hash_raw(params.t_cost, params.m_cost, params.lanes, in_passwd, pwdlen,
+                                                                    salt, saltlen, hash, hashlen);
+         break;
+      case HashParams::argon2i:
+         results = argon2i_hash_raw(params.t_cost, params.m_cost, params.lanes, in_passwd, pwdlen,
+                                                                   salt, saltlen, hash, hashlen);
+         break;
+      default:
+         throw pwfile_error("Unknown argon2 variant in passwd file");
+   }
+   if (results != ARGON2_OK)
+      throw pwfile_error("Could not hash password");
 
    //populate the return hash vector
-   for (int i = 0; i < hashlen; i++) {
-      ret_hash.push_back(hash[i]);
-   }
+   ret_hash.assign(hash, hash + hashlen);
 }
 
 /****************************************************************************************************
- * addUser - First, confirms the user doesn't exist. If not found, then adds the new user with a new
- *           password and salt
+ * addUser - Hashes the password with a new salt, then commits the new user. The check that the user
+ *           doesn't exist yet is made against the file under its lock, so two processes adding the
+ *           same name can't both succeed.
  *
- *    Throws: pwfile_error if issues editing the password file
+ *    Throws: pwfile_error if the user exists or there were issues editing the password file
  ****************************************************************************************************/
 
 void PasswdMgr::addUser(const char *name, const char *passwd) {
-   //Need to generate an entry in the passwd file using a randomly generated 16byte hash and the provided username/passwd
-   std::vector<uint8_t> passhash; // buffer to store the new hash
-   std::vector<uint8_t> salt; //buffer to store the new salt
+   Update update;
+   update.add = true;
+   update.entry.name = name;
+   update.entry.params = _params;
 
    //Generate Salt
-   generateSalt(salt);
+   generateSalt(update.entry.salt);
 
    //Hash the salt + password
-   hashArgon2(passhash, salt, passwd, &salt);
+   hashArgon2(update.entry.hash, update.entry.salt, passwd, _params);
 
-   //Open the password file
-   FileFD pwfile(_pwd_file.c_str());
-   if (!pwfile.openFile(FileFD::appendfd))
-      throw pwfile_error("Could not open passwd file for writing");
+   if (!commitUpdate(update))
+      throw pwfile_error("User already exists");
+}
 
-   //Call writeUser function to write new entry to the openfile
-   std::string stringName = name;
-   if (!writeUser(pwfile, stringName, passhash, salt)) {
-      throw pwfile_error("Could not add user");
+/****************************************************************************************************
+ * importUsers - Adds a list of users in one commit. Repeats within the list are dropped first, the
+ *               passwords are hashed in parallel on the pool (each with a fresh salt), and then every
+ *               user goes through a single commitBatch: the file is read once, checked against its
+ *               name index and written back once.
+ *
+ *    Params:  users - the users, in the order they should appear. Passwords are wiped once hashed.
+ *             pool - threads to hash on, sized for the memory available
+ *             skipped - gets the names that were repeated or already existed
+ *
+ *    Returns: the number of users added
+ *
+ *    Throws: pwfile_error if hashing failed or the password file could not be updated, in which
+ *            case nothing was added
+ ****************************************************************************************************/
+
+size_t PasswdMgr::importUsers(std::vector<NewUser> &users, HashPool &pool,
+                                                   std::vector<std::string> &skipped) {
+   std::vector<Update> updates;
+   updates.reserve(users.size());
+
+   std::unordered_set<std::string> seen;
+   std::vector<NewUser *> sources;     // the user each update came from
+   for (NewUser &user : users) {
+      if (!seen.insert(user.entry.name).second) {
+         skipped.push_back(user.entry.name);
+         continue;
+      }
+
+      updates.emplace_back();
+      Update &update = updates.back();
+      update.add = true;
+      update.entry = user.entry;
+      sources.push_back(&user);
    }
 
+   // Hash in parallel, each job writing only its own update, then wait for the last one
+   std::mutex mutex;
+   std::condition_variable cond;
+   size_t remaining = 0;
+   std::string error;
+
+   for (size_t i = 0; i < updates.size(); i++) {
+      Update &update = updates[i];
+      NewUser &user = *sources[i];
+      if (!update.entry.hash.empty())
+         continue;
+
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         remaining++;
+      }
+      pool.submit([this, &update, &user, &mutex, &cond, &remaining, &error]() {
+         std::string failed;
+         try {
+            update.entry.params = _params;
+            generateSalt(update.entry.salt);
+            hashArgon2(update.entry.hash, update.entry.salt, user.passwd.c_str(), _params);
+         } catch (std::exception &e) {
+            // Anything escaping would skip the count below and leave importUsers waiting
+            failed = e.what();
+         } catch (...) {
+            failed = "Could not hash password";
+         }
+         std::fill(user.passwd.begin(), user.passwd.end(), '\0');
+
+         std::lock_guard<std::mutex> lock(mutex);
+         if (!failed.empty())
+            error = failed;
+         if (--remaining == 0)
+            cond.notify_all();
+      });
+   }
+
+   {
+      std::unique_lock<std::mutex> lock(mutex);
+      cond.wait(lock, [&remaining] { return remaining == 0; });
+   }
+   if (!error.empty())
+      throw pwfile_error(error);
+
+   std::vector<Update *> batch;
+   for (Update &update : updates)
+      batch.push_back(&update);
+   commitBatch(batch);
+
+   size_t added = 0;
+   for (Update &update : updates) {
+      if (update.result)
+         added++;
+      else
+         skipped.push_back(update.entry.name);
+   }
+   return added;
 }
 
-uint8_t PasswdMgr::genRandom()  // Random string generator function.
-{
-   //salt alphabet
-   static const char alphanum[] =
-   "0123456789"
-   "!@#$%^&*"
-   "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
-   "abcdefghijklmnopqrstuvwxyz";
-   
-   int stringLength = sizeof(alphanum) - 1;
-   //random char generation
-   return alphanum[rand() % stringLength];
+/****************************************************************************************************
+ * convertToBinary - Rewrites the password file in the binary PasswdDB format. Does nothing if the
+ *                   file is already binary.
+ *
+ *    Throws: pwfile_error if the file could not be read or written
+ ****************************************************************************************************/
+
+void PasswdMgr::convertToBinary() {
+   FileLock lock(_pwd_file + ".lock");
+
+   std::vector<PasswdDB::Entry> entries;
+   if (loadEntries(entries))
+      return;
+
+   storeEntries(entries, true);
+   tableWritten();
 }
 
-void PasswdMgr::generateSalt(std::vector<uint8_t> &in_salt) {
+/*****************************************************************************************************
+ * SaltSource - per-thread buffer of getrandom() bytes that salts are cut from, so a salt costs a
+ *              copy rather than a syscall and threads never share generator state or a lock. Salts
+ *              are stored in the clear, so keeping a few spare in memory exposes nothing.
+ *****************************************************************************************************/
+
+namespace {
+
+class SaltSource {
+public:
+   void take(uint8_t *dest, size_t len) {
+      if (len > sizeof(_buf) - _pos)
+         refill();
+      memcpy(dest, _buf + _pos, len);
+      _pos += len;
+   }
+
+private:
+   void refill() {
+      size_t got = 0;
+      while (got < sizeof(_buf)) {
+         ssize_t results = getrandom(_buf + got, sizeof(_buf) - got, 0);
+         if (results < 0) {
+            if (errno == EINTR)
+               continue;
+            throw pwfile_error("Could not get random bytes for a salt");
+         }
+         got += results;
+      }
+      _pos = 0;
+   }
+
+   uint8_t _buf[4096];
+   size_t _pos = sizeof(_buf);
+};
 
-   //Populate vector with 16 random alphanumber characters
-   srand(time(0));
-    for(int z=0; z < saltlen; z++)
-    {
-        in_salt.push_back(genRandom());
-    }
+thread_local SaltSource salt_source;
 
 }
 
+/*****************************************************************************************************
+ * generateSalt - appends saltlen bytes of full entropy to in_salt
+ *
+ *    Throws: pwfile_error if the kernel could not supply random bytes
+ *****************************************************************************************************/
+
+void PasswdMgr::generateSalt(std::vector<uint8_t> &in_salt) {
+   uint8_t salt[saltlen];
+   salt_source.take(salt, saltlen);
+   in_salt.insert(in_salt.end(), salt, salt + saltlen);
+}
+
 
 
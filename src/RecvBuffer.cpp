@@ -0,0 +1,79 @@
+#include <errno.h>
+#include <cstring>
+#include "RecvBuffer.h"
+
+/*****************************************************************************************
+ * readFrom - reads whatever fits into the free space at the end of the buffer, first
+ *            sliding unconsumed data to the front if the end has been reached
+ *
+ *    Params:  fd - the FD to read from
+ *
+ *    Returns: the result of the read (0 on end of file, -1 with errno set on error). Also
+ *             -1 with errno EAGAIN if the buffer is full, so callers stop reading.
+ *****************************************************************************************/
+
+ssize_t RecvBuffer::readFrom(FileDesc &fd) {
+   if (_start == _end) {
+      _start = _end = _scan = 0;
+   } else if ((_end == recv_buf_size) && (_start > 0)) {
+      memmove(_data, _data + _start, _end - _start);
+      _end -= _start;
+      _scan -= _start;
+      _start = 0;
+   }
+
+   if (_end == recv_buf_size) {
+      errno = EAGAIN;
+      return -1;
+   }
+
+   ssize_t amt_read = fd.readFD(_data + _end, recv_buf_size - _end);
+   if (amt_read > 0)
+      _end += amt_read;
+   return amt_read;
+}
+
+/*****************************************************************************************
+ * hasLine - checks for a newline in the unconsumed data, resuming where the last search
+ *           left off
+ *****************************************************************************************/
+
+bool RecvBuffer::hasLine() {
+   if (_scan < _start)
+      _scan = _start;
+
+   const char *nl = (const char *) memchr(_data + _scan, '\n', _end - _scan);
+   if (nl == NULL) {
+      _scan = _end;
+      return false;
+   }
+
+   _scan = nl - _data;
+   return true;
+}
+
+/*****************************************************************************************
+ * getLine - takes the next complete line out of the buffer. The newline (and a \r before
+ *           it) is overwritten with a NUL so line.data() can be used as a C string.
+ *
+ *    Params:  line - set to view the line, without the line ending
+ *
+ *    Returns: true if a line was found, false otherwise (line is left alone)
+ *****************************************************************************************/
+
+bool RecvBuffer::getLine(std::string_view &line) {
+   if (!hasLine())
+      return false;
+
+   size_t len = _scan - _start;
+   _data[_scan] = '\0';
+   if ((len > 0) && (_data[_scan - 1] == '\r')) {
+      _data[_scan - 1] = '\0';
+      len--;
+   }
+
+   line = std::string_view(_data + _start, len);
+   _start = _scan + 1;
+   _scan = _start;
+   return true;
+}
@@ -0,0 +1,448 @@
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <stdexcept>
+#include "TCPBench.h"
+
+// Prompts and reply endings the sessions wait for
+const char username_prompt[] = "Username: ";
+const char passwd_prompt[] = "Password: ";
+const char menu_end[] = "Exit - disconnect.\n\n";
+const char newpwd_prompt[] = "New Password: ";
+const char confirmpwd_prompt[] = "Confirm Password: ";
+const char goodbye_end[] = "goodbye!\n";
+const char bad_passwd[] = "Incorrect Password";
+
+// Closed loop: pause before refilling slots after a connect fails immediately
+const int64_t connect_backoff_ns = 10000000;
+
+// Timed stages ahead of the per-command ones
+enum benchstage { st_connect, st_username, st_auth, st_commands };
+
+// Commands the bench knows how to recognize the reply to ("4" has none)
+struct KnownCommand {
+   const char *name;
+   const char *reply_end;
+};
+
+const KnownCommand known_cmds[] = {
+   {"hello", "Hello back!\n"},
+   {"menu", menu_end},
+   {"passwd", menu_end},
+   {"1", "your lives!\n"},
+   {"2", "42\n"},
+   {"3", "terrible idea.\n"},
+   {"5", "siiiiiiinnnggiiinnggg!\n"},
+};
+
+static int64_t nowNs() {
+   return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TCPBench::TCPBench() {
+   bzero(&_addr, sizeof(_addr));
+   setMix("hello=4,1=1,2=1,5=1");
+}
+
+
+TCPBench::~TCPBench() {
+   for (Session &sess : _sessions) {
+      if (sess.fd >= 0)
+         close(sess.fd);
+   }
+}
+
+/**********************************************************************************************
+ * setTarget - sets the address of the server to load
+ *
+ *    Throws: socket_error if the address isn't a valid IPv4 address
+ **********************************************************************************************/
+
+void TCPBench::setTarget(const char *ip_addr, unsigned short port) {
+   _addr.sin_family = AF_INET;
+   _addr.sin_port = htons(port);
+   if (inet_pton(AF_INET, ip_addr, &_addr.sin_addr) != 1)
+      throw socket_error("Invalid server IP address.");
+}
+
+void TCPBench::setLogin(const char *username, const char *password) {
+   _username = username;
+   _password = password;
+}
+
+/**********************************************************************************************
+ * setMix - parses a comma-separated list of command=weight pairs. Each command a session runs
+ *          is picked at random in proportion to the weights.
+ *
+ *    Returns: false if a command is unknown or the weights are all zero (mix is unchanged)
+ **********************************************************************************************/
+
+bool TCPBench::setMix(const char *mix) {
+   std::vector<Command> cmds;
+   unsigned int total = 0;
+
+   std::string spec(mix);
+   size_t pos = 0;
+   while (pos <= spec.size()) {
+      size_t end = spec.find(',', pos);
+      if (end == std::string::npos)
+         end = spec.size();
+      std::string item = spec.substr(pos, end - pos);
+      pos = end + 1;
+      if (item.empty())
+         continue;
+
+      unsigned int weight = 1;
+      size_t eq = item.find('=');
+      if (eq != std::string::npos) {
+         weight = strtoul(item.c_str() + eq + 1, NULL, 10);
+         item.erase(eq);
+      }
+
+      const KnownCommand *known = NULL;
+      for (const KnownCommand &kc : known_cmds) {
+         if (item == kc.name)
+            known = &kc;
+      }
+      if (known == NULL)
+         return false;
+
+      cmds.push_back(Command{item, known->reply_end, weight});
+      total += weight;
+   }
+
+   if (total == 0)
+      return false;
+
+   _cmds.swap(cmds);
+   _total_weight = total;
+   return true;
+}
+
+/**********************************************************************************************
+ * run - generates load for the configured duration, then waits for the sessions still running
+ *       to finish or time out
+ *
+ *    Throws: socket_error for unrecoverable epoll errors
+ **********************************************************************************************/
+
+void TCPBench::run() {
+   // Thousands of sessions need thousands of FDs
+   struct rlimit lim;
+   if (getrlimit(RLIMIT_NOFILE, &lim) == 0) {
+      lim.rlim_cur = lim.rlim_max;
+      setrlimit(RLIMIT_NOFILE, &lim);
+   }
+
+   _sessions = std::vector<Session>(_max_conns);
+   for (Session &sess : _sessions)
+      _free.push_back(&sess);
+
+   _stage_names = {"connect", "username", "auth"};
+   for (Command &cmd : _cmds)
+      _stage_names.push_back(cmd.name);
+   _samples = std::vector<std::vector<uint32_t>>(_stage_names.size());
+
+   _begin_ns = nowNs();
+   int64_t stop_at = _begin_ns + _duration_ns;
+   int64_t next_due = _begin_ns;
+   int64_t interval = (_rate > 0) ? (int64_t) (1e9 / _rate) : 0;
+   int64_t next_sweep = _begin_ns;
+   int64_t retry_at = 0;      // closed loop: no new sessions before this after a failed connect
+
+   while (true) {
+      int64_t now = nowNs();
+      bool starting = (now < stop_at);
+
+      // Closed loop: keep every slot busy, but after a connect that fails on the spot (out of
+      // FDs, nothing listening) back off instead of retrying the freed slot straight away.
+      // Open loop: start whatever has come due, counting sessions that were due while every
+      // slot was busy as skipped.
+      if (starting && (interval == 0)) {
+         while (!_free.empty() && (now >= retry_at)) {
+            if (!startSession(now))
+               retry_at = now + connect_backoff_ns;
+         }
+      } else if (starting) {
+         while ((next_due <= now) && (next_due < stop_at)) {
+            if (_free.empty())
+               _skipped++;
+            else
+               startSession(next_due);
+            next_due += interval;
+         }
+      }
+
+      if (!starting && (_free.size() == _sessions.size()))
+         break;
+
+      if (now >= next_sweep) {
+         expireSessions(now);
+         next_sweep = now + 100000000;
+      }
+
+      // Sleep until the next session is due, an FD is ready or the next timeout sweep
+      int64_t wake_at = next_sweep;
+      if (starting && (interval > 0))
+         wake_at = std::min(wake_at, next_due);
+      else if (starting && !_free.empty())
+         wake_at = std::min(wake_at, std::min(retry_at, stop_at));
+      int ms = (int) std::max<int64_t>(0, (wake_at - now + 999999) / 1000000);
+
+      int num_events = _evloop.waitEvents(ms);
+      for (int i = 0; i < num_events; i++)
+         handleSession(*static_cast<Session *>(_evloop.getData(i)), _evloop.getEvents(i));
+   }
+
+   _end_ns = nowNs();
+}
+
+/**********************************************************************************************
+ * startSession - opens a non-blocking connection in a free slot
+ *
+ *    Params:  due - when the session was supposed to start, which the connect is timed from
+ *
+ *    Returns: false if the connection failed at once, in which case the slot is free again
+ **********************************************************************************************/
+
+bool TCPBench::startSession(int64_t due) {
+   Session &sess = *_free.back();
+   _free.pop_back();
+   _started++;
+
+   sess.inbuf.clear();
+   sess.state = b_connect;
+   sess.stage_start = due;
+   sess.deadline = nowNs() + _timeout_ns;
+   sess.cmds_left = _cmds_per_session;
+
+   sess.fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+   if (sess.fd == -1) {
+      _connect_errors++;
+      endSession(sess, false);
+      return false;
+   }
+
+   int one = 1;
+   setsockopt(sess.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+   if ((connect(sess.fd, (sockaddr *) &_addr, sizeof(_addr)) != 0) && (errno != EINPROGRESS)) {
+      _connect_errors++;
+      endSession(sess, false);
+      return false;
+   }
+
+   _evloop.addFD(sess.fd, EPOLLIN | EPOLLRDHUP | EPOLLET, &sess);
+   return true;
+}
+
+/**********************************************************************************************
+ * endSession - closes the session's connection and frees its slot
+ **********************************************************************************************/
+
+void TCPBench::endSession(Session &sess, bool ok) {
+   if (sess.fd >= 0)
+      close(sess.fd);
+   sess.fd = -1;
+   sess.state = b_idle;
+
+   if (ok)
+      _completed++;
+   else
+      _failed++;
+   _free.push_back(&sess);
+}
+
+/**********************************************************************************************
+ * handleSession - reads what the server sent and moves the session along once the reply it
+ *                 is waiting for is complete
+ **********************************************************************************************/
+
+void TCPBench::handleSession(Session &sess, uint32_t events) {
+   if (sess.state == b_idle)
+      return;
+
+   char buf[16384];
+   ssize_t amt_read;
+   bool eof = false;
+   while ((amt_read = read(sess.fd, buf, sizeof(buf))) > 0)
+      sess.inbuf.append(buf, amt_read);
+   if ((amt_read == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK)))
+      eof = true;
+
+   int64_t now = nowNs();
+   bool progress = true;
+   while (progress) {
+      progress = false;
+
+      switch (sess.state) {
+         case b_connect:
+            if (sess.inbuf.find(username_prompt) == std::string::npos)
+               break;
+            record(st_connect, sess.stage_start, now);
+            _connects++;
+            sess.inbuf.clear();
+            sess.stage_start = now;
+            sess.state = b_username;
+            sendLine(sess, _username);
+            break;
+
+         case b_username:
+            if (sess.inbuf.find(passwd_prompt) == std::string::npos)
+               break;
+            record(st_username, sess.stage_start, now);
+            sess.inbuf.clear();
+            sess.stage_start = now;
+            sess.state = b_passwd;
+            sendLine(sess, _password);
+            break;
+
+         case b_passwd:
+            if (sess.inbuf.find(bad_passwd) != std::string::npos) {
+               endSession(sess, false);
+               return;
+            }
+            if (sess.inbuf.find(menu_end) == std::string::npos)
+               break;
+            record(st_auth, sess.stage_start, now);
+            _auths++;
+            nextCommand(sess, now);
+            progress = true;
+            break;
+
+         case b_newpwd:
+         case b_confirmpwd:
+            if (sess.inbuf.find((sess.state == b_newpwd) ? newpwd_prompt : confirmpwd_prompt)
+                                                                      == std::string::npos)
+               break;
+            sess.inbuf.clear();
+            sess.state = (sess.state == b_newpwd) ? b_confirmpwd : b_command;
+            sendLine(sess, _password);
+            break;
+
+         case b_command:
+            if (sess.inbuf.find(_cmds[sess.cmd].reply_end) == std::string::npos)
+               break;
+            record(st_commands + sess.cmd, sess.stage_start, now);
+            nextCommand(sess, now);
+            progress = true;
+            break;
+
+         case b_exit:
+            if (eof && (sess.inbuf.find(goodbye_end) != std::string::npos)) {
+               endSession(sess, true);
+               return;
+            }
+            break;
+
+         default:
+            break;
+      }
+   }
+
+   if (eof || (events & EPOLLERR))
+      endSession(sess, false);
+}
+
+/**********************************************************************************************
+ * nextCommand - sends the next command from the mix, or exit once the session has run all of
+ *               its commands
+ **********************************************************************************************/
+
+void TCPBench::nextCommand(Session &sess, int64_t now) {
+   sess.inbuf.clear();
+   sess.stage_start = now;
+
+   if (sess.cmds_left == 0) {
+      sess.state = b_exit;
+      sendLine(sess, "exit");
+      return;
+   }
+   sess.cmds_left--;
+
+   // xorshift64 is plenty for picking from the mix
+   _rand_state ^= _rand_state << 13;
+   _rand_state ^= _rand_state >> 7;
+   _rand_state ^= _rand_state << 17;
+   unsigned int pick = _rand_state % _total_weight;
+
+   sess.cmd = 0;
+   while (pick >= _cmds[sess.cmd].weight) {
+      pick -= _cmds[sess.cmd].weight;
+      sess.cmd++;
+   }
+
+   sess.state = (_cmds[sess.cmd].name == "passwd") ? b_newpwd : b_command;
+   sendLine(sess, _cmds[sess.cmd].name);
+}
+
+/**********************************************************************************************
+ * sendLine - sends one line to the server. Requests are tiny and strictly one at a time, so
+ *            they always fit in the socket buffer.
+ **********************************************************************************************/
+
+void TCPBench::sendLine(Session &sess, const std::string &line) {
+   std::string msg = line + "\n";
+   if (write(sess.fd, msg.data(), msg.size()) != (ssize_t) msg.size())
+      sess.deadline = 0;
+}
+
+/**********************************************************************************************
+ * expireSessions - fails sessions that have run past their timeout
+ **********************************************************************************************/
+
+void TCPBench::expireSessions(int64_t now) {
+   for (Session &sess : _sessions) {
+      if ((sess.state != b_idle) && (now >= sess.deadline))
+         endSession(sess, false);
+   }
+}
+
+void TCPBench::record(unsigned int stage, int64_t start, int64_t now) {
+   _samples[stage].push_back((uint32_t) std::min<int64_t>(now - start, UINT32_MAX));
+}
+
+/**********************************************************************************************
+ * report - prints session counts, rates and latency percentiles for each stage
+ **********************************************************************************************/
+
+void TCPBench::report() {
+   double secs = (_end_ns - _begin_ns) / 1e9;
+
+   printf("sessions: %llu started, %llu completed, %llu failed", (unsigned long long) _started,
+          (unsigned long long) _completed, (unsigned long long) _failed);
+   if (_skipped > 0)
+      printf(", %llu skipped (all %u slots busy)", (unsigned long long) _skipped, _max_conns);
+   if (_connect_errors > 0)
+      printf(", %llu could not connect", (unsigned long long) _connect_errors);
+   printf(" in %.2f s\n", secs);
+   printf("connects/sec: %.1f   auth/sec: %.1f   sessions/sec: %.1f\n\n", _connects / secs,
+          _auths / secs, _completed / secs);
+
+   printf("%-10s %10s %10s %10s %10s %10s   (ms)\n", "stage", "count", "p50", "p99", "p999",
+          "max");
+   for (unsigned int i = 0; i < _samples.size(); i++) {
+      std::vector<uint32_t> &samples = _samples[i];
+      if (samples.empty())
+         continue;
+
+      std::sort(samples.begin(), samples.end());
+      auto pct = [&samples](double p) {
+         return samples[std::min(samples.size() - 1, (size_t) (p * samples.size()))] / 1e6;
+      };
+      printf("%-10s %10zu %10.3f %10.3f %10.3f %10.3f\n", _stage_names[i].c_str(), samples.size(),
+             pct(0.50), pct(0.99), pct(0.999), samples.back() / 1e6);
+   }
+}
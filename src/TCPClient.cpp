@@ -3,13 +3,12 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <poll.h>
+#include <errno.h>
 #include <stdexcept>
 #include <strings.h>
-#include <stropts.h>
 #include <string.h>
-#include <sys/select.h>
 #include <stdio.h>
-#include <stdexcept>
 
 #include "TCPClient.h"
 
@@ -45,64 +44,71 @@ void TCPClient::connectTo(const char *ip_addr, unsigned short port) {
 }
 
 /**********************************************************************************************
- * handleConnection - Performs a loop that checks if the connection is still open, then 
- *                    looks for user input and sends it if available. Finally, looks for data
- *                    on the socket and sends it.
+ * setScript - runs in script mode, sending the commands in filename instead of reading stdin
+ **********************************************************************************************/
+
+void TCPClient::setScript(const char *filename) {
+   _script_file = filename;
+}
+
+/**********************************************************************************************
+ * handleConnection - Waits in poll for the server, stdin, or (while sends are backed up) the
+ *                    socket becoming writable, and handles whichever are ready. Returns when
+ *                    the server closes the connection, or in script mode when the server has
+ *                    been quiet for the idle timeout after the whole script was sent.
  * 
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
 
 void TCPClient::handleConnection() {
-   
-   bool connected = true;
-   int sin_bufsize = 0;
-   ssize_t rsize = 0;
 
-   timespec sleeptime;
-   sleeptime.tv_sec = 0;
-   sleeptime.tv_nsec = 1000000;
+   if (!_script_file.empty())
+      loadScript();
 
+   // Writes must not block while the server is waiting for us to read its replies
+   _sockfd.setNonBlocking();
 
    // Loop while we have a valid connection
-   while (connected) {
+   while (true) {
+      flushOutput();
+
+      bool sending = (_out_off < _out_buf.size());
+      pollfd fds[2];
+      fds[0].fd = _sockfd.getFD();
+      fds[0].events = POLLIN | (sending ? POLLOUT : 0);
+      fds[1].fd = _stdin.getFD();
+      fds[1].events = POLLIN;
+      int nfds = _stdin_open ? 2 : 1;
+
+      // Once a script is out, the server gets the idle timeout to finish answering
+      int timeout = (_script_file.empty() || sending) ? -1 : _idle_ms;
+
+      int ready = poll(fds, nfds, timeout);
+      if (ready == -1) {
+         if (errno == EINTR)
+            continue;
+         throw std::runtime_error("Poll on client failed.");
+      }
 
-      // If the connection was closed, exit
-      if (!_sockfd.isOpen())
+      if (ready == 0) {
+         fprintf(stderr, "No reply from server for %d ms, giving up.\n", _idle_ms);
          break;
-
-      // Send any user input
-      if ((sin_bufsize = readStdin()) > 0)  {
-         std::string subbuf = _in_buf.substr(0, sin_bufsize+1);
-         _sockfd.writeFD(subbuf);
-         _in_buf.erase(0, sin_bufsize+1);
       }
 
       // Read any data from the socket and display to the screen and handle errors
-      std::string buf;
-      if (_sockfd.hasData()) {
-         if ((rsize = _sockfd.readFD(buf)) == -1) {
-            throw std::runtime_error("Read on client socket failed.");
-         }
-
-         // Select indicates data, but 0 bytes...usually because it's disconnected
-         if (rsize == 0) {
-            closeConn();
+      if (fds[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+         if (!readSocket())
             break;
-         }
-
-         // Display to the screen
-         if (rsize > 0) {
-            printf("%s", buf.c_str());
-            fflush(stdout);
-         }
       }
 
-      nanosleep(&sleeptime, NULL);
+      // Send any user input
+      if ((nfds == 2) && (fds[1].revents & (POLLIN | POLLHUP | POLLERR)))
+         readStdin();
    }
 }
 
 /**********************************************************************************************
- * closeConnection - Your comments here
+ * closeConnection - closes the socket, if the server hasn't already
  *
  *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
  **********************************************************************************************/
@@ -112,35 +118,123 @@ void TCPClient::closeConn() {
 }
 
 /******************************************************************************
- * readStdin - takes input from the user and stores it in a buffer. We only send
- *             the buffer after a carriage return
+ * loadScript - reads the script file and queues all of it to be sent. Stdin is
+ *              not read in script mode.
  *
- *    Return: 0 if not ready to send, buffer length if ready
+ *    Throws: runtime_error if the script can't be read
  *****************************************************************************/
-int TCPClient::readStdin() {
 
-   if (!_stdin.hasData()) {
-      return 0;
-   }
+void TCPClient::loadScript() {
+   FileFD script(_script_file.c_str());
+   std::string data;
+
+   if (!script.openFile(FileFD::readfd) || (script.readAll(data) < 0))
+      throw std::runtime_error("Unable to read script file " + _script_file);
+   script.closeFD();
+
+   if (!data.empty() && (data.back() != '\n'))
+      data += '\n';
+
+   _out_buf += data;
+   _stdin_open = false;
+}
+
+/******************************************************************************
+ * readStdin - takes input from the user and stores it in a buffer. Every
+ *             complete line is queued to send, as is a partial line once it
+ *             fills stdin_bufsize or stdin closes.
+ *****************************************************************************/
+
+void TCPClient::readStdin() {
 
    // More input, get it and concat it to the buffer
    std::string readbuf;
-   int amt_read;
+   ssize_t amt_read;
    if ((amt_read = _stdin.readFD(readbuf)) < 0) {
+      if ((errno == EAGAIN) || (errno == EINTR))
+         return;
       throw std::runtime_error("Read on stdin failed unexpectedly.");
    }
-   
+
+   // End of input--send what's left and keep showing replies until the server hangs up
+   if (amt_read == 0) {
+      _stdin_open = false;
+      _out_buf += _in_buf;
+      _in_buf.clear();
+      return;
+   }
+
    _in_buf += readbuf;
 
    // Did we either fill up the buffer or is there a newline/carriage return?
-   int sendto;
+   size_t sendto;
    if (_in_buf.length() >= stdin_bufsize)
       sendto = _in_buf.length();
-   else if ((sendto = _in_buf.find("\n")) == std::string::npos) {
-      return 0;
+   else if ((sendto = _in_buf.rfind('\n')) == std::string::npos)
+      return;
+   else
+      sendto++;
+
+   _out_buf.append(_in_buf, 0, sendto);
+   _in_buf.erase(0, sendto);
+}
+
+/******************************************************************************
+ * readSocket - reads everything the server has sent so far and shows it
+ *
+ *    Return: false once the server has closed the connection
+ *****************************************************************************/
+
+bool TCPClient::readSocket() {
+   char buf[16384];
+   ssize_t rsize;
+
+   while ((rsize = _sockfd.readFD(buf, sizeof(buf))) > 0)
+      fwrite(buf, 1, rsize, stdout);
+   fflush(stdout);
+
+   if (rsize == 0) {
+      closeConn();
+      return false;
+   }
+
+   if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR))
+      return true;
+
+   // Reset by the server
+   if (errno == ECONNRESET) {
+      closeConn();
+      return false;
    }
-   
-   return sendto;
+   throw std::runtime_error("Read on client socket failed.");
 }
 
+/******************************************************************************
+ * flushOutput - sends as much queued input as the socket will take without
+ *               blocking. The rest waits for poll to report it writable.
+ *****************************************************************************/
 
+void TCPClient::flushOutput() {
+   while (_out_off < _out_buf.size()) {
+      ssize_t written = send(_sockfd.getFD(), _out_buf.data() + _out_off,
+                             _out_buf.size() - _out_off, MSG_NOSIGNAL);
+      if (written < 0) {
+         if ((errno == EAGAIN) || (errno == EWOULDBLOCK))
+            return;
+         if (errno == EINTR)
+            continue;
+
+         // The server went away--the read side will see it
+         if ((errno == EPIPE) || (errno == ECONNRESET)) {
+            _out_buf.clear();
+            _out_off = 0;
+            return;
+         }
+         throw std::runtime_error("Write on client socket failed.");
+      }
+      _out_off += written;
+   }
+
+   _out_buf.clear();
+   _out_off = 0;
+}
@@ -1,20 +1,43 @@
 #include <stdexcept>
 #include <strings.h>
+#include <errno.h>
 #include <unistd.h>
 #include <cstring>
+#include <cctype>
 #include <algorithm>
 #include <iostream>
 #include "TCPConn.h"
 #include "strfuncts.h"
 #include "PasswdMgr.h"
-
-// The filename/path of the password file
-const char pwdfilename[] = "passwd";
-
-//Need to make a PasswdMgr to handle your username/password functions
-
-TCPConn::TCPConn(std::shared_ptr<LogSvr> inputServer):pwdMgr(pwdfilename) { // LogMgr &server_log):_server_log(server_log) {
+#include "TCPWorker.h"
+#include "Metrics.h"
+
+// Fixed replies, queued by pointer so sending them never copies
+const char weather_text[] =
+   "You want a prediction about the weather? You're asking the wrong Phil.\n"
+   "I'm going to give you a prediction about this winter. It's going to be\n"
+   "cold, it's going to be dark and it's going to last you for the rest of\n"
+   "your lives!\n";
+
+// Make this your own!
+const char menu_text[] =
+   "Available choices: \n"
+   "  1). Provide weather report.\n"
+   "  2). Learn the secret of the universe.\n"
+   "  3). Play global thermonuclear war\n"
+   "  4). Do nothing.\n"
+   "  5). Sing. Sing a song. Make it simple, to last the whole day long.\n\n"
+   "Other commands: \n"
+   "  Hello - self-explanatory\n"
+   "  Passwd - change your password\n"
+   "  Menu - display this menu\n"
+   "  Exit - disconnect.\n\n";
+
+TCPConn::TCPConn(int fd, const sockaddr_in &peer, LogSvr *inputServer, PasswdMgr *passwdMgr,
+                                                                  HashPool *hashPool)
+                 :_connfd(fd, peer), _hashpool(hashPool), pwdMgr(passwdMgr) {
    logServer = inputServer;
+   _timer.owner = this;
 }
 
 
@@ -23,24 +46,12 @@ TCPConn::~TCPConn() {
 }
 
 /**********************************************************************************************
- * accept - simply calls the acceptFD FileDesc method to accept a connection on a server socket.
- *
- *    Params: server - an open/bound server file descriptor with an available connection
- *
- *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
- **********************************************************************************************/
-
-bool TCPConn::accept(SocketFD &server) {
-   return _connfd.acceptFD(server);
-}
-
-/**********************************************************************************************
- * sendText - simply calls the sendText FileDesc method to send a string to this FD
+ * sendText - queues a copy of a string to be sent on the next flush
  *
  *    Params:  msg - the string to be sent
  *             size - if we know how much data we should expect to send, this should be populated
  *
- *    Throws: runtime_error for unrecoverable errors
+ *    Returns: 0 if queued, -1 if the client has let too much output back up (it is disconnected)
  **********************************************************************************************/
 
 int TCPConn::sendText(const char *msg) {
@@ -48,12 +59,57 @@ int TCPConn::sendText(const char *msg) {
 }
 
 int TCPConn::sendText(const char *msg, int size) {
-   if (_connfd.writeFD(msg, size) < 0) {
-      return -1;  
+   if (!_outq.pushCopy(msg, size)) {
+      disconnect();
+      return -1;
    }
    return 0;
 }
 
+/**********************************************************************************************
+ * sendStatic - like sendText, but queues a pointer to the text instead of a copy. Only for
+ *              text that lives for the whole program.
+ **********************************************************************************************/
+
+int TCPConn::sendStatic(const char *msg) {
+   return sendStatic(msg, strlen(msg));
+}
+
+int TCPConn::sendStatic(const char *msg, int size) {
+   if (!_outq.pushStatic(msg, size)) {
+      disconnect();
+      return -1;
+   }
+   return 0;
+}
+
+/**********************************************************************************************
+ * flushOutput - writes queued replies. If the socket can't take them all, the worker watches
+ *               it for writability and the connection gets another turn when it drains.
+ **********************************************************************************************/
+
+void TCPConn::flushOutput() {
+   if (!isConnected())
+      return;
+
+   bool flushed;
+   {
+      Metrics::Timer timer(Metrics::stage_flush);
+      flushed = _outq.flush(_connfd);
+   }
+   if (!flushed) {
+      _outq.clear();
+      disconnect();
+      return;
+   }
+
+   bool want_out = !_outq.empty();
+   if ((want_out != _watch_out) && (_worker != NULL)) {
+      _worker->watchWritable(this, want_out);
+      _watch_out = want_out;
+   }
+}
+
 /**********************************************************************************************
  * startAuthentication - Sets the status to request username
  *
@@ -65,54 +121,83 @@ void TCPConn::startAuthentication() {
    //Sets status of connection to username
    _status = s_username;
 
-   _connfd.writeFD("Username: "); 
+   sendStatic("Username: "); 
 
 }
 
 /**********************************************************************************************
- * handleConnection - performs a check of the connection, looking for data on the socket and
- *                    handling it based on the _status, or stage, of the connection
+ * handleConnection - called by the reactor when the socket is ready or when complete lines are
+ *                    still buffered. Drains the socket, handles every complete line and
+ *                    flushes all their replies together. Socket and password file errors
+ *                    only cost this connection, which is dropped.
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
 void TCPConn::handleConnection() {
 
-   timespec sleeptime;
-   sleeptime.tv_sec = 0;
-   sleeptime.tv_nsec = 100000000;
+   // Closed while a password check was still running, nothing left to do
+   if (!isConnected())
+      return;
 
    try {
-      switch (_status) {
-         case s_username:
-            getUsername();
-            break;
-
-         case s_passwd:
-            getPasswd();
-            break;
-   
-         case s_changepwd:
-         case s_confirmpwd:
-            changePassword();
-            break;
-
-         case s_menu:
-            getMenuChoice();
-
-            break;
-
-         default:
-            throw std::runtime_error("Invalid connection status!");
-            break;
-      }
+      if (!readInput())
+         return;
+
+      dispatchInput();
+      flushOutput();
    } catch (socket_error &e) {
       std::cout << "Socket error, disconnecting.";
       disconnect();
       return;
+   } catch (pwfile_error &e) {
+      std::cerr << "Error with the password file, disconnecting: " << e.what() << std::endl;
+      sendStatic("Server error, disconnecting...\n");
+      disconnect();
+      return;
    }
 
-   nanosleep(&sleeptime, NULL);
+}
+
+/**********************************************************************************************
+ * dispatchInput - handles each complete line of input in turn, based on the _status, or stage,
+ *                 of the connection when the line is reached, so a client can send a whole
+ *                 session (username, password, commands) at once. Stops early, leaving the
+ *                 rest buffered, while a password check runs or while the client isn't
+ *                 reading the replies it already has.
+ *
+ *    Throws: runtime_error for unrecoverable issues
+ **********************************************************************************************/
+
+void TCPConn::dispatchInput() {
+   while (isConnected() && !_auth_pending && !outputBlocked() && _inbuf.hasLine())
+      dispatchLine();
+}
+
+void TCPConn::dispatchLine() {
+   switch (_status) {
+      case s_username:
+         getUsername();
+         break;
+
+      case s_passwd:
+         getPasswd();
+         break;
+
+      case s_changepwd:
+      case s_confirmpwd:
+         changePassword();
+         break;
+
+      case s_menu:
+         getMenuChoice();
+
+         break;
+
+      default:
+         throw std::runtime_error("Invalid connection status!");
+         break;
+   }
 }
 
 /**********************************************************************************************
@@ -123,10 +208,7 @@ void TCPConn::handleConnection() {
  **********************************************************************************************/
 
 void TCPConn::getUsername() {
-   //Wait for user data to continue
-   if (!_connfd.hasData())
-      return;
-   std::string username;
+   std::string_view username;
 
 
    //username should be populated with user input
@@ -135,78 +217,92 @@ void TCPConn::getUsername() {
 
 
    //Check username list for username entered
-      std::vector<uint8_t> hash, salt;
-      if (pwdMgr.checkUser(username.c_str())) {
+   bool found;
+   {
+      Metrics::Timer timer(Metrics::stage_user_lookup);
+      found = pwdMgr->checkUser(username.data());
+   }
+      if (found) {
          _status = s_passwd;
          _username = username;
-         _connfd.writeFD("Password: ");
+         sendStatic("Password: ");
       }
       //No matching username
       else {
-         _connfd.writeFD("Invalid Username, disconnecting...");
+         sendStatic("Invalid Username, disconnecting...");
          disconnect();
 
          //Log the event
-         std::string ip;
-         _connfd.getIPAddrStr(ip);
-         logServer->logString("Invalid username entered - " + username + " from " + ip + " @ " );
+         logServer->logEvent(ev_username, out_fail, _connfd.getSockAddr(), username.data());
 
       }
 }
 
 /**********************************************************************************************
  * getPasswd - called from handleConnection when status is s_passwd--if it finds user data,
- *             it assumes it's a password and hashes it, comparing to the database hash. Users
- *             get two tries before they are disconnected
+ *             it assumes it's a password and sends it to the hash pool to be checked. The
+ *             connection stays in s_passwd until finishPasswd gets the result.
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
 void TCPConn::getPasswd() {
-   //Wait on user input
-   if (!_connfd.hasData())
+   std::string_view password;
+
+   //Read the password from client
+   if (!getUserInput(password))
       return;
 
+   // The result comes back on a pool thread, so hand it to our worker's loop. If the
+   // connection is gone by then, the handle no longer matches and the result is dropped.
+   _auth_pending = true;
+   ConnHandle handle = _handle;
+   TCPWorker *worker = _worker;
+   pwdMgr->checkPasswdAsync(_username.c_str(), password.data(), *_hashpool,
+      [handle, worker](bool result) {
+         worker->post(handle, [result](TCPConn &conn) { conn.finishPasswd(result); });
+      });
+}
 
-   std::string password;
-   bool authenticated = false;
-   int attempts = 0;
+/**********************************************************************************************
+ * finishPasswd - runs on the connection's loop when the password check completes. Users get
+ *                two tries before they are disconnected
+ *
+ *    Params:  authenticated - true if the password matched the stored hash
+ *
+ *    Throws: runtime_error for unrecoverable issues
+ **********************************************************************************************/
 
+void TCPConn::finishPasswd(bool authenticated) {
+   _auth_pending = false;
 
-   while (!authenticated) {
-      //Read the password from client
-      if (!getUserInput(password))
-         return;
+   // The client left while we were hashing
+   if (!isConnected())
+      return;
 
-      //Check if the password matches the stored one
-      if (pwdMgr.checkPasswd(_username.c_str(), password.c_str())) {
-         _status = s_menu;
-         sendMenu();
-         authenticated = true;
-         
-         //Log the event
-         std::string ip;
-         _connfd.getIPAddrStr(ip);
-         logServer->logString(_username + " from " + ip + " successfully authenticated @ ");
-      }
+   Metrics::count(authenticated ? Metrics::ctr_logins_ok : Metrics::ctr_logins_failed);
 
-      //Incorrect password attempt
-      else { _connfd.writeFD("Incorrect Password try again.\n"); }
-      attempts += 1; 
+   //Check if the password matches the stored one
+   if (authenticated) {
+      _status = s_menu;
+      sendMenu();
 
-      //Too many incorrect attempts
-      if (attempts == max_attempts) {
-         _connfd.writeFD("Too many unsuccessful attempts, disconnecting...");
-         _connfd.closeFD();
+      //Log the event
+      logServer->logEvent(ev_auth, out_ok, _connfd.getSockAddr(), _username.c_str());
+      return;
+   }
 
-         //Log the event
-         std::string ip;
-         _connfd.getIPAddrStr(ip);
-         logServer->logString(_username + " from " + ip + " unsuccessfully authenticated @ ");
+   //Incorrect password attempt
+   sendStatic("Incorrect Password try again.\n");
+   _pwd_attempts += 1; 
 
+   //Too many incorrect attempts
+   if (_pwd_attempts == max_attempts) {
+      sendStatic("Too many unsuccessful attempts, disconnecting...");
+      closeConn();
 
-         return;
-      }
+      //Log the event
+      logServer->logEvent(ev_auth, out_fail, _connfd.getSockAddr(), _username.c_str());
    }
 }
 
@@ -214,47 +310,56 @@ void TCPConn::getPasswd() {
  * changePassword - called from handleConnection when status is s_changepwd or s_confirmpwd--
  *                  if it finds user data, with status s_changepwd, it saves the user-entered
  *                  password. If s_confirmpwd, it checks to ensure the saved password from
- *                  the s_changepwd phase is equal, then saves the new pwd to the database
+ *                  the s_changepwd phase is equal, then sends the change to the hash pool.
+ *                  The connection stays in s_confirmpwd until finishChangePasswd gets the
+ *                  result.
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
 void TCPConn::changePassword() {
-   //Wait on user input
-   if (!_connfd.hasData())
-      return;
 
    //switch on status of first password or second
    switch(_status) {
 
       //First entry
-      case s_changepwd:
+      case s_changepwd: {
          //Read the command line for new password
-         if (!getUserInput(_newpwd))
+         std::string_view newpwd;
+         if (!getUserInput(newpwd))
             return;
+         _newpwd = newpwd;
          _status = s_confirmpwd;
-         _connfd.writeFD("Confirm Password: ");
+         sendStatic("Confirm Password: ");
          return;
+      }
 
       //Second entry
       case s_confirmpwd:
-         std::string confirmPwd;
+         std::string_view confirmPwd;
          if (!getUserInput(confirmPwd))
             return;
-         if (confirmPwd !=_newpwd) {
+         if (confirmPwd != _newpwd.view()) {
             //Passwords don't match return them to menu
-            _connfd.writeFD("Passwords do not match, aborting...\n");
+            sendStatic("Passwords do not match, aborting...\n");
             _status = s_menu;
             sendMenu();
             _newpwd.clear();
             return;
          }
          else {
-            //Passwords matched, need to record the new password
-            pwdMgr.changePasswd(_username.c_str(), _newpwd.c_str());
-            _status = s_menu;
-            sendMenu();
-            //Clear out the stored password
+            //Passwords matched, hash and record the new password off the loop
+            _auth_pending = true;
+            ConnHandle handle = _handle;
+            TCPWorker *worker = _worker;
+            pwdMgr->changePasswdAsync(_username.c_str(), _newpwd.c_str(), *_hashpool,
+               [handle, worker](bool changed) {
+                  worker->post(handle, [changed](TCPConn &conn) {
+                     conn.finishChangePasswd(changed);
+                  });
+               });
+
+            //Clear out the stored password, the pool has its own copy
             _newpwd.clear();
          }
 
@@ -263,91 +368,151 @@ void TCPConn::changePassword() {
 
 }
 
+/**********************************************************************************************
+ * finishChangePasswd - runs on the connection's loop when a password change has been hashed
+ *                      and committed (or failed), and returns the user to the menu
+ *
+ *    Params:  changed - true if the new password is on disk
+ **********************************************************************************************/
+
+void TCPConn::finishChangePasswd(bool changed) {
+   _auth_pending = false;
+
+   logServer->logEvent(ev_passwd, changed ? out_ok : out_fail, _connfd.getSockAddr(),
+                                                                    _username.c_str());
+
+   // The client left while we were hashing
+   if (!isConnected())
+      return;
+
+   if (!changed)
+      sendStatic("Password change failed.\n");
+   _status = s_menu;
+   sendMenu();
+}
+
 
 /**********************************************************************************************
- * getUserInput - Gets user data and includes a buffer to look for a carriage return before it is
- *                considered a complete user input. Performs some post-processing on it, removing
- *                the newlines
+ * readInput - Reads everything currently available on the socket into the input buffer. The
+ *             socket is edge-triggered, so it must be drained until the read would block, or
+ *             until the buffer is full (hasPendingInput brings us back once lines are taken).
  *
- *    Params: cmd - the buffer to store commands - contents left alone if no command found
+ *    Returns: false if the peer closed the connection, the read failed or the client sent a
+ *             line longer than the buffer (the connection is disconnected), true otherwise
+ **********************************************************************************************/
+
+bool TCPConn::readInput() {
+   ssize_t amt_read;
+
+   while ((amt_read = _inbuf.readFrom(_connfd)) > 0)
+      _had_input = true;
+
+   if ((amt_read == 0) || ((errno != EAGAIN) && (errno != EWOULDBLOCK))) {
+      disconnect();
+      return false;
+   }
+
+   _recv_stalled = _inbuf.full();
+   if (_recv_stalled && !_inbuf.hasLine()) {
+      sendStatic("Input line too long, disconnecting...");
+      disconnect();
+      return false;
+   }
+   return true;
+}
+
+/**********************************************************************************************
+ * getUserInput - Takes the next complete (newline terminated) line from the input buffer,
+ *                without the line ending. The line points into the buffer and is only valid
+ *                until the next readInput, so copy anything that must be kept.
  *
- *    Returns: true if a carriage return was found and cmd was populated, false otherwise.
+ *    Params: line - set to the line, NUL terminated - left alone if no line found
  *
- *    Throws: runtime_error for unrecoverable issues
+ *    Returns: true if a carriage return was found and line was populated, false otherwise.
  **********************************************************************************************/
 
-bool TCPConn::getUserInput(std::string &cmd) {
-   std::string readbuf;
-
-   // read the data on the socket
-   _connfd.readFD(readbuf);
+bool TCPConn::getUserInput(std::string_view &line) {
+   return _inbuf.getLine(line);
+}
 
-   // concat the data onto anything we've read before
-   _inputbuf += readbuf;
+/**********************************************************************************************
+ * hasPendingInput - true if a complete line is still waiting in the input buffer, or reading
+ *                   stopped on a full buffer, and it can be handled now (not while a password
+ *                   check is outstanding or replies are backed up)
+ **********************************************************************************************/
 
-   // If it doesn't have a carriage return, then it's not a command
-   int crpos;
-   if ((crpos = _inputbuf.find("\n")) == std::string::npos)
+bool TCPConn::hasPendingInput() {
+   if (_auth_pending || outputBlocked())
       return false;
+   return _recv_stalled || _inbuf.hasLine();
+}
 
-   cmd = _inputbuf.substr(0, crpos);
-   _inputbuf.erase(0, crpos+1);
+/**********************************************************************************************
+ * commands - the menu's command table, filled with the built-in commands on first use
+ **********************************************************************************************/
 
-   // Remove \r if it is there
-   clrNewlines(cmd);
+static CommandTable builtinCommands() {
+   CommandTable table;
 
-   return true;
+   // Don't be lazy and use my outputs--make your own!
+   table.add("hello", "Hello back!\n");
+   table.add("menu", menu_text, sizeof(menu_text) - 1);
+   table.add("exit", "Disconnecting...goodbye!\n", [](TCPConn &conn) { conn.disconnect(); });
+   table.add("passwd", NULL, [](TCPConn &conn) { conn.setPassword(); });
+   table.add("1", weather_text, sizeof(weather_text) - 1);
+   table.add("2", "42\n");
+   table.add("3", "That seems like a terrible idea.\n");
+   table.add("4", NULL);
+   table.add("5", "I'm singing, I'm in a computer and I'm siiiingiiiing! I'm in a\n"
+                  "computer and I'm siiiiiiinnnggiiinnggg!\n");
+   return table;
+}
+
+CommandTable &TCPConn::commands() {
+   static CommandTable table = builtinCommands();
+   return table;
 }
 
 /**********************************************************************************************
- * getMenuChoice - Gets the user's command and interprets it, calling the appropriate function
- *                 if required.
+ * getMenuChoice - Gets the user's command and looks it up in the command table, queueing its
+ *                 reply and running its handler. Unknown commands are echoed back lowercased.
  *
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 
 void TCPConn::getMenuChoice() {
-   if (!_connfd.hasData())
-      return;
-   std::string cmd;
-   if (!getUserInput(cmd))
+   std::string_view line;
+   if (!getUserInput(line))
       return;
-   lower(cmd);      
 
-   // Don't be lazy and use my outputs--make your own!
-   std::string msg;
-   if (cmd.compare("hello") == 0) {
-      _connfd.writeFD("Hello back!\n");
-   } else if (cmd.compare("menu") == 0) {
-      sendMenu();
-   } else if (cmd.compare("exit") == 0) {
-      _connfd.writeFD("Disconnecting...goodbye!\n");
-      disconnect();
-   } else if (cmd.compare("passwd") == 0) {
-      _connfd.writeFD("New Password: ");
-      _status = s_changepwd;
-   } else if (cmd.compare("1") == 0) {
-      msg += "You want a prediction about the weather? You're asking the wrong Phil.\n";
-      msg += "I'm going to give you a prediction about this winter. It's going to be\n";
-      msg += "cold, it's going to be dark and it's going to last you for the rest of\n";
-      msg += "your lives!\n";
-      _connfd.writeFD(msg);
-   } else if (cmd.compare("2") == 0) {
-      _connfd.writeFD("42\n");
-   } else if (cmd.compare("3") == 0) {
-      _connfd.writeFD("That seems like a terrible idea.\n");
-   } else if (cmd.compare("4") == 0) {
-
-   } else if (cmd.compare("5") == 0) {
-      _connfd.writeFD("I'm singing, I'm in a computer and I'm siiiingiiiing! I'm in a\n");
-      _connfd.writeFD("computer and I'm siiiiiiinnnggiiinnggg!\n");
-   } else {
-      msg = "Unrecognized command: ";
-      msg += cmd;
-      msg += "\n";
-      _connfd.writeFD(msg);
+   Metrics::Timer timer(Metrics::stage_dispatch);
+   Metrics::count(Metrics::ctr_commands);
+
+   const CommandTable::Command *cmd = commands().find(line);
+   if (cmd != NULL) {
+      if (cmd->reply_len > 0)
+         sendStatic(cmd->reply, cmd->reply_len);
+      if (cmd->handler != NULL)
+         cmd->handler(*this);
+      return;
    }
 
+   char echo[recv_buf_size];
+   for (size_t i = 0; i < line.size(); i++)
+      echo[i] = tolower((unsigned char) line[i]);
+
+   sendStatic("Unrecognized command: ");
+   sendText(echo, line.size());
+   sendStatic("\n");
+}
+
+/**********************************************************************************************
+ * setPassword - starts a password change from the menu
+ **********************************************************************************************/
+
+void TCPConn::setPassword() {
+   sendStatic("New Password: ");
+   _status = s_changepwd;
 }
 
 /**********************************************************************************************
@@ -356,22 +521,7 @@ void TCPConn::getMenuChoice() {
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 void TCPConn::sendMenu() {
-   std::string menustr;
-
-   // Make this your own!
-   menustr += "Available choices: \n";
-   menustr += "  1). Provide weather report.\n";
-   menustr += "  2). Learn the secret of the universe.\n";
-   menustr += "  3). Play global thermonuclear war\n";
-   menustr += "  4). Do nothing.\n";
-   menustr += "  5). Sing. Sing a song. Make it simple, to last the whole day long.\n\n";
-   menustr += "Other commands: \n";
-   menustr += "  Hello - self-explanatory\n";
-   menustr += "  Passwd - change your password\n";
-   menustr += "  Menu - display this menu\n";
-   menustr += "  Exit - disconnect.\n\n";
-
-   _connfd.writeFD(menustr);
+   sendStatic(menu_text, sizeof(menu_text) - 1);
 }
 
 
@@ -381,28 +531,70 @@ void TCPConn::sendMenu() {
  *    Throws: runtime_error for unrecoverable issues
  **********************************************************************************************/
 void TCPConn::disconnect() {
+   if (!isConnected())
+      return;
 
-   //Log the event
-   std::string ip;
-   _connfd.getIPAddrStr(ip);
-   if (_username.length() != 0) {
-      logServer->logString(_username + " from " + ip + " disconnected @ ");
-   }
-   //Disconnected before valid username
-   else {
-      logServer->logString("Connection from " + ip + " disconnected @ ");
-   }
+   //Log the event, without a user if they disconnected before a valid username
+   logServer->logEvent(ev_disconnect, out_ok, _connfd.getSockAddr(), _username.c_str());
+   closeConn();
+}
+
+/**********************************************************************************************
+ * closeConn - gives queued replies (goodbyes, error messages) one last chance to go out, then
+ *             closes the FD. Whatever the socket won't take without blocking is dropped.
+ **********************************************************************************************/
+void TCPConn::closeConn() {
+   _outq.flush(_connfd);
+   _outq.clear();
    _connfd.closeFD();
 }
 
 
 /**********************************************************************************************
- * isConnected - performs a simple check on the socket to see if it is still open 
+ * nextTimeout - works out how the connection's timer should change after a turn. The login
+ *               phases get one deadline from when they start; once logged in, the idle timer
+ *               restarts whenever the client sends something.
  *
- *    Throws: runtime_error for unrecoverable issues
+ *    Params:  timeouts - the server's timeouts in seconds
+ *
+ *    Returns: seconds to (re)arm the timer for, 0 to cancel it, -1 to leave it alone
+ **********************************************************************************************/
+
+int TCPConn::nextTimeout(const ConnTimeouts &timeouts) {
+   bool logged_in = (_status != s_username) && (_status != s_passwd);
+
+   if ((_status == _timed_status) && !(logged_in && _had_input))
+      return -1;
+
+   _timed_status = _status;
+   _had_input = false;
+
+   if (_status == s_username)
+      return timeouts.username;
+   if (_status == s_passwd)
+      return timeouts.passwd;
+   return timeouts.idle;
+}
+
+/**********************************************************************************************
+ * timeOut - drops a connection that sat too long in one phase
+ **********************************************************************************************/
+
+void TCPConn::timeOut() {
+   if (!isConnected())
+      return;
+
+   sendStatic("\nTimed out, disconnecting...\n");
+   logServer->logEvent(ev_timeout, out_fail, _connfd.getSockAddr(), _username.c_str());
+   disconnect();
+}
+
+/**********************************************************************************************
+ * isConnected - checks whether the socket is still open. Every close goes through closeFD,
+ *               which resets the FD, so this needs no syscall.
  **********************************************************************************************/
 bool TCPConn::isConnected() {
-   return _connfd.isOpen();
+   return _connfd.getFD() >= 0;
 }
 
 /**********************************************************************************************
@@ -4,6 +4,9 @@
 #include <arpa/inet.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <cstring>
 #include <stdexcept>
 #include <strings.h>
 #include <vector>
@@ -11,16 +14,32 @@
 #include <memory>
 #include <sstream>
 #include "TCPServer.h"
+#include "Metrics.h"
 #include <fstream>
 #include <algorithm>
+#include <thread>
+#include <sys/eventfd.h>
+
+// The filename/path of the password file, server event log and whitelist
+const char pwdfilename[] = "passwd";
+const char logfilename[] = "server.evlog";
+const char wlfilename[] = "whitelist";
+
+// Sent to peers that aren't on the whitelist
+const char reject_msg[] = "Unauthorized Connection, disconnecting!\n";
 
 TCPServer::TCPServer(){ 
-   logServer = std::make_shared<LogSvr>("server.log");
+   logServer = std::make_shared<LogSvr>(logfilename);
+   pwdMgr = std::make_shared<PasswdMgr>(pwdfilename);
 }
 
 
 TCPServer::~TCPServer() {
+   // Queued checks and reloads use the password manager, so they finish before it goes
+   hashPool.reset();
 
+   if (_stopfd >= 0)
+      close(_stopfd);
 }
 
 /**********************************************************************************************
@@ -34,118 +53,314 @@ void TCPServer::bindSvr(const char *ip_addr, short unsigned int port) {
 
    struct sockaddr_in servaddr;
 
-   logServer->logString("Server started @ ");
+   logServer->logEvent(ev_start, out_ok);
 
    // Set the socket to nonblocking
    _sockfd.setNonBlocking();
 
    // Load the socket information to prep for binding
+   if (_reuseport)
+      _sockfd.setReusePort();
    _sockfd.bindFD(ip_addr, port);
+   _bind_ip = ip_addr;
+   _bind_port = port;
 
-   //Populate whitelist for incoming connections
-   std::ifstream wlFile;
-   std::string line;
+   //Populate whitelist for incoming connections--it reloads itself when the file changes
+   whiteList = std::make_shared<Whitelist>(wlfilename);
 
-   wlFile.open("whitelist");
-   if (!wlFile) {
-      std::cout << "Unable to read Whitelist file\n";
-   }
-   else {
-      while (getline(wlFile, line)) {
-         //add line to the vector
-         whiteList.push_back(line);
-      }
-   }
-   wlFile.close();
+}
 
+/**********************************************************************************************
+ * setBacklog - sets the length of the queue of connections waiting to be accepted. The kernel
+ *              caps it at net.core.somaxconn.
+ **********************************************************************************************/
+
+void TCPServer::setBacklog(int backlog) {
+   _backlog = backlog;
 }
 
 /**********************************************************************************************
- * listenSvr - Performs a loop to look for connections and create TCPConn objects to handle
- *             them. Also loops through the list of connections and handles data received and
- *             sending of data. 
+ * setReusePort - in multi-threaded mode, gives each worker its own SO_REUSEPORT listener on
+ *                the server address instead of accepting on one thread. Must be set before
+ *                bindSvr.
+ **********************************************************************************************/
+
+void TCPServer::setReusePort(bool reuseport) {
+   _reuseport = reuseport;
+}
+
+/**********************************************************************************************
+ * setNumThreads - selects multi-threaded mode with the given number of event-loop threads
  *
- *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ *    Params:  num_threads - number of worker threads, 0 for one per available core
+ **********************************************************************************************/
+
+void TCPServer::setNumThreads(unsigned int num_threads) {
+   if (num_threads == 0)
+      num_threads = std::max(1u, std::thread::hardware_concurrency());
+   _num_threads = num_threads;
+}
+
+/**********************************************************************************************
+ * setHashMemCap - limits how many password hashes run at once so their combined memory stays
+ *                 under the cap
+ *
+ *    Params:  mem_mib - the cap in MiB
+ **********************************************************************************************/
+
+void TCPServer::setHashMemCap(unsigned int mem_mib) {
+   _hash_mem_cap = (size_t) mem_mib * 1024 * 1024;
+}
+
+/**********************************************************************************************
+ * setLogSync - sets the log's fsync policy
+ *
+ *    Params:  policy - never, after every batch, or at most every sync_ms milliseconds
+ **********************************************************************************************/
+
+void TCPServer::setLogSync(LogSvr::fsync_policy policy, unsigned int sync_ms) {
+   logServer->setSyncPolicy(policy, sync_ms);
+}
+
+/**********************************************************************************************
+ * setAuthCache - caches successful password checks, bounded in size and time
+ *
+ *    Params:  ttl_secs - how long a check is remembered, 0 for no cache
+ *             max_entries - most checks remembered at once
+ **********************************************************************************************/
+
+void TCPServer::setAuthCache(unsigned int ttl_secs, size_t max_entries) {
+   pwdMgr->setAuthCache(ttl_secs, max_entries);
+}
+
+/**********************************************************************************************
+ * setHashParams - sets the argon2 variant and costs passwords are hashed with. Users whose
+ *                 hash was made with other parameters are rehashed when they next log in.
+ **********************************************************************************************/
+
+void TCPServer::setHashParams(const HashParams &params) {
+   pwdMgr->setHashParams(params);
+}
+
+/**********************************************************************************************
+ * setMetricsPort - starts recording metrics and serves them on the given loopback port once
+ *                  the server is listening
+ **********************************************************************************************/
+
+void TCPServer::setMetricsPort(unsigned short port) {
+   _metrics_port = port;
+   Metrics::setEnabled(port != 0);
+}
+
+/**********************************************************************************************
+ * listenSvr - Starts the server socket listening and runs the event loops. In single-threaded
+ *             mode one worker runs on this thread and accepts connections itself. Otherwise
+ *             one worker thread is started per requested thread, and this thread only
+ *             accepts connections and hands them to the least loaded worker. Returns if a
+ *             worker fails, once all of them have stopped.
+ *
+ *    Throws: the error a worker failed on (pwfile_error, socket_error, ...), or
+ *            socket_error if listening failed
  **********************************************************************************************/
 
 void TCPServer::listenSvr() {
 
-   bool online = true;
-   timespec sleeptime;
-   sleeptime.tv_sec = 0;
-   sleeptime.tv_nsec = 100000000;
-   int num_read = 0;
+   // A client that hangs up with replies still queued should fail the write, not kill us
+   signal(SIGPIPE, SIG_IGN);
 
    // Start the server socket listening
-   _sockfd.listenFD(5);
+   _sockfd.listenFD(_backlog);
 
-    
-   while (online) {
-      struct sockaddr_in cliaddr;
-      socklen_t len = sizeof(cliaddr);
-
-      if (_sockfd.hasData()) {
-         TCPConn *new_conn = new TCPConn(logServer);
-         if (!new_conn->accept(_sockfd)) {
-            // _server_log.strerrLog("Data received on socket but failed to accept.");
-            continue;
-         }
-         std::cout << "***Got a connection***\n";
+   if (_metrics_port != 0) {
+      _metrics_svr.reset(new MetricsSvr());
+      _metrics_svr->bindSvr("127.0.0.1", _metrics_port);
+      _metrics_svr->start();
+   }
 
-         // Get their IP Address string to use in logging and check if they are on the White-List
-         std::string ipaddr_str;
-         new_conn->getIPAddrStr(ipaddr_str);
+   // Threads for hashes at the configured cost; records that cost more lower the limit
+   hashPool = std::make_shared<HashPool>(HashPool::threadsForCap(_hash_mem_cap,
+                                          (size_t) pwdMgr->getHashParams().m_cost * 1024));
+   pwdMgr->useHashPool(*hashPool, _hash_mem_cap);
+
+   if (_num_threads == 0) {
+      _workers.emplace_back(new TCPWorker(*this));
+      _workers[0]->watchListener(_sockfd);
+      _workers[0]->runLoop();
+      stopWorkers();
+      return;
+   }
 
-         //Connection IP Matches WhiteList do the normal stuff
-         if (std::find(whiteList.begin(), whiteList.end(), ipaddr_str) != whiteList.end()) {
+   if ((_stopfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+      throw socket_error("Failed creating server stop eventfd.");
+   _evloop.addFD(_stopfd, EPOLLIN, &_stopfd);
+
+   // Sharded: every worker accepts on its own SO_REUSEPORT listener and keeps what it
+   // accepts, so there is no acceptor thread and no handoff
+   if (_reuseport) {
+      for (unsigned int i = 0; i < _num_threads; i++) {
+         SocketFD *listener = &_sockfd;
+         if (i > 0) {
+            _listeners.emplace_back(new SocketFD());
+            listener = _listeners.back().get();
+            listener->setNonBlocking();
+            listener->setReusePort();
+            listener->bindFD(_bind_ip.c_str(), _bind_port);
+            listener->listenFD(_backlog);
+         }
 
-            _connlist.push_back(std::unique_ptr<TCPConn>(new_conn));
+         _workers.emplace_back(new TCPWorker(*this));
+         _workers.back()->watchListener(*listener);
+         _workers.back()->start();
+      }
 
-            new_conn->sendText("Welcome to the CSCE 689 Server!\n");
+      // Nothing to do here but wait for a failure
+      while (_evloop.waitEvents() <= 0)
+         ;
+      stopWorkers();
+      return;
+   }
 
-            //Log the event
-            logServer->logString("Connection from " + ipaddr_str + "@ ");
+   for (unsigned int i = 0; i < _num_threads; i++) {
+      _workers.emplace_back(new TCPWorker(*this));
+      _workers.back()->start();
+   }
 
-            // Change this later
-            new_conn->startAuthentication();
+   _evloop.addFD(_sockfd.getFD(), EPOLLIN | EPOLLET, &_sockfd);
+   bool online = true;
+   while (online) {
+      int num_events = _evloop.waitEvents();
+      for (int i = 0; i < num_events; i++) {
+         if (_evloop.getData(i) == &_stopfd) {
+            online = false;
+            continue;
          }
-         //Unauthorized IP disconnect the connection
-         else {
-            new_conn->sendText("Unauthorized Connection, disconnecting!\n");
-            new_conn->disconnect();
-            //Log the event
-            logServer->logString("Unauthorized connection attempt from" + ipaddr_str + "@ ");
 
+         try {
+            acceptConns(_sockfd);
+         } catch (...) {
+            fail(std::current_exception());
          }
       }
+   }
+   stopWorkers();
+}
 
-      // Loop through our connections, handling them
-      std::list<std::unique_ptr<TCPConn>>::iterator tptr = _connlist.begin();
-      while (tptr != _connlist.end())
-      {
-         // If the user lost connection
-         if (!(*tptr)->isConnected()) {
-            // Log it
+/**********************************************************************************************
+ * fail - records the error a worker's loop died on and wakes the thread in listenSvr, which
+ *        stops the rest. Only the first error is kept and reported.
+ **********************************************************************************************/
+
+void TCPServer::fail(std::exception_ptr error) {
+   std::lock_guard<std::mutex> lock(_fail_mutex);
+   if (_failure)
+      return;
+   _failure = error;
+
+   try {
+      std::rethrow_exception(error);
+   } catch (std::exception &e) {
+      std::cerr << "Event loop failed, shutting down: " << e.what() << std::endl;
+   } catch (...) {
+      std::cerr << "Event loop failed, shutting down\n";
+   }
+
+   uint64_t one = 1;
+   if ((_stopfd >= 0) && (write(_stopfd, &one, sizeof(one)) < 0)) {
+      // Already signalled
+   }
+}
+
+/**********************************************************************************************
+ * stopWorkers - stops and joins every worker, then rethrows the error one of them failed on
+ **********************************************************************************************/
+
+void TCPServer::stopWorkers() {
+   for (auto &worker : _workers)
+      worker->stop();
+   for (auto &worker : _workers)
+      worker->join();
+
+   std::lock_guard<std::mutex> lock(_fail_mutex);
+   if (_failure)
+      std::rethrow_exception(_failure);
+}
 
-            // Remove them from the connect list
-            tptr = _connlist.erase(tptr);
-            std::cout << "Connection disconnected.\n";
+/**********************************************************************************************
+ * acceptConns - Called when the server socket is ready. Since it is edge-triggered, keeps
+ *               accepting until the queue is empty. Each peer is checked against the whitelist
+ *               straight after accept4, so rejected peers are closed without allocating a
+ *               TCPConn. Admitted sockets are handed to a worker, which builds the connection
+ *               in its own pool.
+ *
+ *    Params:  listener - the listening socket that is ready
+ *             owner - the worker accepting on its own loop, which keeps the connections, or
+ *                     NULL to hand them to the least-loaded worker
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
+
+void TCPServer::acceptConns(SocketFD &listener, TCPWorker *owner) {
+
+   sockaddr_in peer;
+   int fd;
+   while (true) {
+      int64_t start = Metrics::startTime();
+      if ((fd = listener.acceptRaw(peer)) == -1) {
+         // The peer gave up while queued, try the next one
+         if ((errno == EINTR) || (errno == ECONNABORTED))
             continue;
-         }
 
-         // Process any user inputs
-         (*tptr)->handleConnection();
+         // Anything but an empty queue (out of FDs or memory) leaves the rest queued for the
+         // next readiness event
+         if ((errno != EAGAIN) && (errno != EWOULDBLOCK))
+            std::cerr << "Accept failed: " << strerror(errno) << "\n";
+         return;
+      }
 
-         // Increment our iterator
-         tptr++;
+      Metrics::record(Metrics::stage_accept, Metrics::startTime() - start);
+
+      //Unauthorized IP--turn it away before spending anything on it, and only count it
+      bool allowed;
+      {
+         Metrics::Timer timer(Metrics::stage_whitelist);
+         allowed = whiteList->allowed((const sockaddr *) &peer);
+      }
+
+      if (!allowed) {
+         Metrics::count(Metrics::ctr_rejected);
+         send(fd, reject_msg, sizeof(reject_msg) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+         close(fd);
+         logServer->logRejected();
+         continue;
       }
 
-      // So we're not chewing up CPU cycles unnecessarily
-      nanosleep(&sleeptime, NULL);
-   } 
+      std::cout << "***Got a connection***\n";
+      Metrics::count(Metrics::ctr_accepted);
+
+      //Connection IP Matches WhiteList--the worker builds the connection and greets it
+      if (owner != NULL)
+         owner->addConn(fd, peer);
+      else
+         pickWorker()->handoff(fd, peer);
+   }
+}
+
+/**********************************************************************************************
+ * pickWorker - returns the worker with the fewest connections. The scan starts one past the
+ *              last pick so ties are spread round-robin.
+ **********************************************************************************************/
+
+TCPWorker *TCPServer::pickWorker() {
+   unsigned int best = _next_worker % _workers.size();
 
+   for (unsigned int i = 1; i < _workers.size(); i++) {
+      unsigned int idx = (_next_worker + i) % _workers.size();
+      if (_workers[idx]->numConns() < _workers[best]->numConns())
+         best = idx;
+   }
 
-   
+   _next_worker = best + 1;
+   return _workers[best].get();
 }
 
 
@@ -0,0 +1,323 @@
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include "TCPWorker.h"
+#include "TCPServer.h"
+#include "Metrics.h"
+
+// Events every connection is registered for
+const uint32_t conn_events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+
+// epoll tags for the worker's own FDs. Connection handles never match these, as a live
+// slot's generation is odd.
+const uint64_t wake_tag = 0;
+const uint64_t listen_tag = 1;
+
+const char welcome_msg[] = "Welcome to the CSCE 689 Server!\n";
+
+static int64_t nowMs() {
+   return std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/**********************************************************************************************
+ * TCPWorker (constructor) - Creates the worker's epoll instance and the eventfd used to wake it
+ *
+ *    Throws: socket_error if the eventfd could not be created
+ **********************************************************************************************/
+
+TCPWorker::TCPWorker(TCPServer &server):_server(server), _timeouts(server.getTimeouts()),
+                                        _numconns(0), _stopping(false) {
+   if ((_wakefd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) == -1)
+      throw socket_error("Failed creating worker eventfd.");
+
+   _evloop.addFD(_wakefd, EPOLLIN | EPOLLET, wake_tag);
+}
+
+
+TCPWorker::~TCPWorker() {
+   join();
+   close(_wakefd);
+
+   // Sockets handed over but never adopted
+   for (Accepted &acc : _inbox)
+      close(acc.fd);
+}
+
+/**********************************************************************************************
+ * start - runs the event loop on a new thread
+ **********************************************************************************************/
+
+void TCPWorker::start() {
+   _threaded = true;
+   _thread = std::thread(&TCPWorker::runLoop, this);
+}
+
+void TCPWorker::join() {
+   if (_thread.joinable())
+      _thread.join();
+}
+
+void TCPWorker::stop() {
+   _stopping.store(true);
+   wake();
+}
+
+/**********************************************************************************************
+ * watchListener - registers a server socket with this worker's loop so it accepts new
+ *                 connections itself. Used when the server runs a single worker, or gives
+ *                 each worker its own SO_REUSEPORT listener.
+ **********************************************************************************************/
+
+void TCPWorker::watchListener(SocketFD &sockfd) {
+   _listener = &sockfd;
+   _evloop.addFD(sockfd.getFD(), EPOLLIN | EPOLLET, listen_tag);
+}
+
+/**********************************************************************************************
+ * handoff - gives a freshly accepted socket to this worker. When the worker runs on its own
+ *           thread the socket goes through the inbox and the loop is woken up.
+ *
+ *    Throws: socket_error if the connection could not be registered with the loop
+ **********************************************************************************************/
+
+void TCPWorker::handoff(int fd, const sockaddr_in &peer) {
+   if (!_threaded) {
+      addConn(fd, peer);
+      return;
+   }
+
+   _numconns.fetch_add(1, std::memory_order_relaxed);
+   {
+      std::lock_guard<std::mutex> lock(_inbox_mutex);
+      _inbox.push_back(Accepted{fd, peer});
+   }
+   wake();
+}
+
+/**********************************************************************************************
+ * addConn - takes a socket this worker accepted itself, skipping the inbox
+ **********************************************************************************************/
+
+void TCPWorker::addConn(int fd, const sockaddr_in &peer) {
+   _numconns.fetch_add(1, std::memory_order_relaxed);
+   adoptConn(fd, peer);
+}
+
+/**********************************************************************************************
+ * post - queues a task to run on this worker's loop. When it runs, the connection gets a turn
+ *        in the same pass as connections with socket events, so anything it buffered
+ *        meanwhile is handled and a closed connection is reaped. A task for a connection
+ *        that was released meanwhile is dropped.
+ **********************************************************************************************/
+
+void TCPWorker::post(ConnHandle conn, std::function<void(TCPConn &)> task) {
+   {
+      std::lock_guard<std::mutex> lock(_inbox_mutex);
+      _tasks.emplace_back(conn, std::move(task));
+   }
+   wake();
+}
+
+/**********************************************************************************************
+ * wake - bumps the eventfd so the loop returns from epoll_wait
+ **********************************************************************************************/
+
+void TCPWorker::wake() {
+   uint64_t one = 1;
+   if (write(_wakefd, &one, sizeof(one)) < 0) {
+      // Counter is already non-zero, so the loop will wake anyway
+   }
+}
+
+/**********************************************************************************************
+ * runLoop - runs the reactor until the worker is stopped. Nothing may escape a worker thread,
+ *           so an error the loop can't recover from is reported to the server, which stops
+ *           all the workers and rethrows it from listenSvr.
+ **********************************************************************************************/
+
+void TCPWorker::runLoop() {
+   try {
+      serveLoop();
+   } catch (...) {
+      _server.fail(std::current_exception());
+   }
+}
+
+/**********************************************************************************************
+ * serveLoop - Runs the epoll reactor. Every connection is registered edge-triggered, so the loop
+ *             only wakes when something is ready and only visits the connections that have
+ *             events. Connections are registered by handle, and an event whose handle no
+ *             longer matches a live connection is ignored. A connection that still has complete
+ *             lines buffered after its turn is queued for another turn on the next pass, so a
+ *             client pasting many commands cannot starve the others.
+ *
+ *    Throws: socket_error for recoverable errors, runtime_error for unrecoverable types
+ **********************************************************************************************/
+
+void TCPWorker::serveLoop() {
+
+   std::vector<TCPConn *> ready, closed;
+   std::vector<void *> expired;
+
+   while (!_stopping.load(std::memory_order_relaxed)) {
+      // Don't block if connections still have buffered commands waiting, otherwise sleep
+      // until the next timer could expire
+      ready.clear();
+      ready.swap(_pending);
+      int num_events = _evloop.waitEvents(ready.empty() ? _timers.msUntilNext(nowMs()) : 0);
+      int64_t now = nowMs();
+
+      for (int i = 0; i < num_events; i++) {
+         uint64_t tag = _evloop.getTag(i);
+         if (tag == wake_tag)
+            drainInbox(ready);
+         else if (tag == listen_tag)
+            _server.acceptConns(*_listener, this);
+         else if (TCPConn *conn = _conns.lookup(tag))
+            ready.push_back(conn);
+      }
+
+      // Connections past their deadline are dropped, then reaped like any other close
+      _timers.advance(now, expired);
+      for (void *owner : expired) {
+         TCPConn *conn = static_cast<TCPConn *>(owner);
+         conn->timeOut();
+         ready.push_back(conn);
+      }
+      expired.clear();
+
+      // A connection can be both pending and freshly ready--only give it one turn
+      std::sort(ready.begin(), ready.end());
+      ready.erase(std::unique(ready.begin(), ready.end()), ready.end());
+
+      for (TCPConn *conn : ready) {
+         // Process any user inputs
+         conn->handleConnection();
+
+         // A password check still running for a closed connection finds its handle stale
+         if (!conn->isConnected()) {
+            closed.push_back(conn);
+         }
+         else {
+            armTimer(conn, now);
+            if (conn->hasPendingInput())
+               _pending.push_back(conn);
+         }
+      }
+
+      if (!closed.empty())
+         reapConns(closed);
+   }
+}
+
+/**********************************************************************************************
+ * adoptConn - builds the connection for an accepted socket in this worker's pool, registers it
+ *             with the loop and sends the greeting. Must run on the loop's thread.
+ **********************************************************************************************/
+
+void TCPWorker::adoptConn(int fd, const sockaddr_in &peer) {
+   TCPConn *conn = _conns.create(fd, peer, _server.getLogSvr(), _server.getPasswdMgr(),
+                                                                _server.getHashPool());
+   conn->setWorker(this);
+   conn->sendStatic(welcome_msg, sizeof(welcome_msg) - 1);
+
+   //Log the event
+   _server.getLogSvr()->logEvent(ev_connect, out_ok, conn->getSockAddr());
+
+   conn->startAuthentication();
+
+   try {
+      _evloop.addFD(conn->getFD(), conn_events, conn->getHandle());
+   } catch (socket_error &e) {
+      // Only this connection is lost
+      std::cerr << "Could not watch new connection: " << e.what() << std::endl;
+      conn->disconnect();
+      std::vector<TCPConn *> closed(1, conn);
+      reapConns(closed);
+      return;
+   }
+   conn->flushOutput();
+   armTimer(conn, nowMs());
+}
+
+/**********************************************************************************************
+ * armTimer - starts, restarts or cancels a connection's timer for the phase it is now in
+ **********************************************************************************************/
+
+void TCPWorker::armTimer(TCPConn *conn, int64_t now_ms) {
+   int secs = conn->nextTimeout(_timeouts);
+   if (secs > 0)
+      _timers.schedule(conn->timer(), (uint64_t) secs * 1000, now_ms);
+   else if (secs == 0)
+      _timers.cancel(conn->timer());
+}
+
+/**********************************************************************************************
+ * watchWritable - adds or removes EPOLLOUT for a connection whose replies are backed up. Any
+ *                 event gives the connection a turn, which flushes the queue.
+ **********************************************************************************************/
+
+void TCPWorker::watchWritable(TCPConn *conn, bool watch) {
+   _evloop.modFD(conn->getFD(), watch ? (conn_events | EPOLLOUT) : conn_events,
+                                                                    conn->getHandle());
+}
+
+/**********************************************************************************************
+ * drainInbox - resets the eventfd, adopts every connection the acceptor handed over and runs
+ *              the posted tasks
+ *
+ *    Params:  ready - connections the tasks were posted for are added to get a turn
+ **********************************************************************************************/
+
+void TCPWorker::drainInbox(std::vector<TCPConn *> &ready) {
+   uint64_t count;
+   if (read(_wakefd, &count, sizeof(count)) < 0) {
+      // Nothing to reset--another pass already drained it
+   }
+
+   std::vector<Accepted> newconns;
+   std::vector<std::pair<ConnHandle, std::function<void(TCPConn &)>>> tasks;
+   {
+      std::lock_guard<std::mutex> lock(_inbox_mutex);
+      newconns.swap(_inbox);
+      tasks.swap(_tasks);
+   }
+
+   for (Accepted &acc : newconns)
+      adoptConn(acc.fd, acc.peer);
+
+   for (auto &task : tasks) {
+      TCPConn *conn = _conns.lookup(task.first);
+      if (conn == NULL)
+         continue;
+      task.second(*conn);
+      ready.push_back(conn);
+   }
+}
+
+/**********************************************************************************************
+ * reapConns - Returns connections that closed during this pass to the pool. Closing the FD
+ *             already dropped them from the epoll instance.
+ *
+ *    Params:  closed - the connections to remove, cleared on return
+ **********************************************************************************************/
+
+void TCPWorker::reapConns(std::vector<TCPConn *> &closed) {
+   std::sort(closed.begin(), closed.end());
+   closed.erase(std::unique(closed.begin(), closed.end()), closed.end());
+
+   Metrics::count(Metrics::ctr_closed, closed.size());
+   for (TCPConn *conn : closed) {
+      _timers.cancel(conn->timer());
+      _conns.release(conn);
+   }
+
+   _numconns.fetch_sub(closed.size(), std::memory_order_relaxed);
+   for (unsigned int i = 0; i < closed.size(); i++)
+      std::cout << "Connection disconnected.\n";
+   closed.clear();
+}
@@ -0,0 +1,181 @@
+#include "TimingWheel.h"
+
+// First wheel has 256 slots of one tick, the others 64 slots of a whole turn of the wheel
+// below, so four wheels cover 2^26 ticks (77 days at 100 ms). Longer timers are clamped.
+const unsigned int level0_bits = 8;
+const unsigned int level_bits = 6;
+const unsigned int level0_size = 1 << level0_bits;
+const unsigned int level_size = 1 << level_bits;
+const uint64_t max_delta = (1ULL << (level0_bits + 3 * level_bits)) - 1;
+
+static unsigned int levelShift(unsigned int level) {
+   return (level == 0) ? 0 : level0_bits + (level - 1) * level_bits;
+}
+
+TimingWheel::TimingWheel(unsigned int tick_ms):_tick_ms(tick_ms),
+                                       _slots(level0_size + (num_levels - 1) * level_size) {
+   for (TimerNode &slot : _slots)
+      slot.prev = slot.next = &slot;
+}
+
+
+TimingWheel::~TimingWheel() {
+
+}
+
+TimerNode &TimingWheel::head(unsigned int level, unsigned int slot) {
+   if (level == 0)
+      return _slots[slot];
+   return _slots[level0_size + (level - 1) * level_size + slot];
+}
+
+/**********************************************************************************************
+ * schedule - (re)schedules a timer. The expiry is rounded up to a tick, so timers never fire
+ *            early, and fire at most one tick late.
+ *
+ *    Params:  node - the timer, cancelled first if it was already scheduled
+ *             delay_ms - how long from now it should fire
+ *             now_ms - the current time in ms, from the same clock passed to advance
+ **********************************************************************************************/
+
+void TimingWheel::schedule(TimerNode &node, uint64_t delay_ms, int64_t now_ms) {
+   if (!_started) {
+      _now_tick = now_ms / _tick_ms;
+      _started = true;
+   }
+
+   cancel(node);
+
+   uint64_t expires = (now_ms + delay_ms + _tick_ms - 1) / _tick_ms;
+   node.expires = (expires > _now_tick) ? expires : _now_tick + 1;
+   insert(node);
+   _count++;
+}
+
+/**********************************************************************************************
+ * cancel - unlinks a timer from its slot. Does nothing if it isn't scheduled.
+ **********************************************************************************************/
+
+void TimingWheel::cancel(TimerNode &node) {
+   if (!node.scheduled())
+      return;
+
+   node.prev->next = node.next;
+   node.next->prev = node.prev;
+   node.prev = node.next = NULL;
+   _count--;
+
+   if (node.level == 0) {
+      TimerNode &slot = head(0, node.slot);
+      if (slot.next == &slot)
+         _occupied[node.slot >> 6] &= ~(1ULL << (node.slot & 63));
+   }
+}
+
+/**********************************************************************************************
+ * insert - links a timer into the slot for how far off it is
+ **********************************************************************************************/
+
+void TimingWheel::insert(TimerNode &node) {
+   uint64_t delta = node.expires - _now_tick;
+   if (delta > max_delta) {
+      delta = max_delta;
+      node.expires = _now_tick + delta;
+   }
+
+   unsigned int level = 0;
+   while ((level < num_levels - 1) && (delta >= (1ULL << levelShift(level + 1))))
+      level++;
+
+   unsigned int mask = (level == 0) ? level0_size - 1 : level_size - 1;
+   node.level = level;
+   node.slot = (node.expires >> levelShift(level)) & mask;
+
+   TimerNode &slot = head(level, node.slot);
+   node.next = &slot;
+   node.prev = slot.prev;
+   slot.prev->next = &node;
+   slot.prev = &node;
+
+   if (level == 0)
+      _occupied[node.slot >> 6] |= 1ULL << (node.slot & 63);
+}
+
+/**********************************************************************************************
+ * cascade - moves every timer in a slot of a higher wheel back down to where it now belongs
+ **********************************************************************************************/
+
+void TimingWheel::cascade(unsigned int level, unsigned int slot) {
+   TimerNode &list = head(level, slot);
+
+   while (list.next != &list) {
+      TimerNode *node = list.next;
+      node->prev->next = node->next;
+      node->next->prev = node->prev;
+      insert(*node);
+   }
+}
+
+/**********************************************************************************************
+ * advance - processes every tick up to now_ms, expiring the timers due on each. When the
+ *           first wheel wraps, the next slot of each wheel above that also wrapped is
+ *           cascaded down.
+ *
+ *    Params:  now_ms - the current time in ms
+ *             expired - the owners of expired timers are appended here
+ **********************************************************************************************/
+
+void TimingWheel::advance(int64_t now_ms, std::vector<void *> &expired) {
+   uint64_t target = now_ms / _tick_ms;
+
+   while (_now_tick < target) {
+      // Nothing scheduled, so there is nothing to walk past
+      if (_count == 0) {
+         _now_tick = target;
+         break;
+      }
+
+      _now_tick++;
+
+      unsigned int idx = _now_tick & (level0_size - 1);
+      for (unsigned int level = 1; (idx == 0) && (level < num_levels); level++) {
+         idx = (_now_tick >> levelShift(level)) & (level_size - 1);
+         cascade(level, idx);
+      }
+
+      unsigned int slot = _now_tick & (level0_size - 1);
+      TimerNode &list = head(0, slot);
+      while (list.next != &list) {
+         TimerNode *node = list.next;
+         cancel(*node);
+         expired.push_back(node->owner);
+      }
+   }
+}
+
+/**********************************************************************************************
+ * msUntilNext - how long the loop can sleep before advance has work: the next non-empty slot
+ *               of the first wheel, or the wrap (which cascades) if it's empty
+ **********************************************************************************************/
+
+int TimingWheel::msUntilNext(int64_t now_ms) {
+   if (_count == 0)
+      return -1;
+
+   unsigned int cur = _now_tick & (level0_size - 1);
+   uint64_t ticks = level0_size - cur;
+   for (unsigned int i = 1; i < level0_size - cur; i++) {
+      unsigned int slot = cur + i;
+      if (_occupied[slot >> 6] == 0) {
+         i += 63 - (slot & 63);
+         continue;
+      }
+      if (_occupied[slot >> 6] & (1ULL << (slot & 63))) {
+         ticks = i;
+         break;
+      }
+   }
+
+   int64_t wait = (int64_t) ((_now_tick + ticks) * _tick_ms) - now_ms;
+   return (wait > 0) ? (int) wait : 0;
+}
@@ -0,0 +1,215 @@
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <iostream>
+#include <chrono>
+#include "Whitelist.h"
+#include "FileDesc.h"
+
+// How often (ns) checks look at whether the whitelist file changed on disk
+const int64_t wl_check_ns = 1000000000LL;
+
+const unsigned int root_v4 = 0;
+const unsigned int root_v6 = 1;
+
+Whitelist::Whitelist(const char *wl_file):_wl_file(wl_file), _next_check(0) {
+   bzero(&_loaded_stat, sizeof(_loaded_stat));
+
+   // Load now so a missing or bad file is reported at startup
+   getTable();
+}
+
+
+Whitelist::~Whitelist() {
+
+}
+
+/*****************************************************************************************************
+ * allowed - checks a peer address against the current table
+ *
+ *    Params:  addr - an AF_INET or AF_INET6 sockaddr, as returned by accept
+ *
+ *    Returns: true if an entry covers the address, false otherwise (and for other families)
+ *****************************************************************************************************/
+
+bool Whitelist::allowed(const sockaddr *addr) {
+   std::shared_ptr<const Table> table = getTable();
+
+   if (addr->sa_family == AF_INET) {
+      const sockaddr_in *sin = (const sockaddr_in *) addr;
+      return table->contains(root_v4, (const uint8_t *) &sin->sin_addr, 32);
+   }
+
+   if (addr->sa_family == AF_INET6) {
+      const uint8_t *bytes = ((const sockaddr_in6 *) addr)->sin6_addr.s6_addr;
+      if (IN6_IS_ADDR_V4MAPPED((const in6_addr *) bytes))
+         return table->contains(root_v4, bytes + 12, 32);
+      return table->contains(root_v6, bytes, 128);
+   }
+
+   return false;
+}
+
+/*****************************************************************************************************
+ * getTable - returns the current table, first reloading it if the file changed. The file is only
+ *            stat'ed once per wl_check_ns, so most checks make no syscalls.
+ *****************************************************************************************************/
+
+std::shared_ptr<const Whitelist::Table> Whitelist::getTable() {
+   int64_t now = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now().time_since_epoch()).count();
+
+   if (now >= _next_check.load(std::memory_order_relaxed))
+      refreshTable(now);
+
+   return std::atomic_load(&_table);
+}
+
+/*****************************************************************************************************
+ * refreshTable - stats the whitelist file and rebuilds the table if the file was replaced or its
+ *                size or modification time changed since it was loaded. If the file can't be read,
+ *                the table already loaded stays in use (an empty one at startup, allowing nobody).
+ *
+ *    Params:  now - steady clock time in ns, used to schedule the next check
+ *****************************************************************************************************/
+
+void Whitelist::refreshTable(int64_t now) {
+   std::lock_guard<std::mutex> lock(_reload_mutex);
+
+   // Another thread got here first
+   if (now < _next_check.load(std::memory_order_relaxed))
+      return;
+   _next_check.store(now + wl_check_ns, std::memory_order_relaxed);
+
+   struct stat st;
+   bool readable = (stat(_wl_file.c_str(), &st) == 0);
+
+   if (readable && _table && (st.st_ino == _loaded_stat.st_ino) &&
+       (st.st_size == _loaded_stat.st_size) &&
+       (st.st_mtim.tv_sec == _loaded_stat.st_mtim.tv_sec) &&
+       (st.st_mtim.tv_nsec == _loaded_stat.st_mtim.tv_nsec))
+      return;
+
+   std::string data;
+   if (readable) {
+      FileFD wlfile(_wl_file.c_str());
+      readable = wlfile.openFile(FileFD::readfd) && (wlfile.readAll(data) >= 0);
+      wlfile.closeFD();
+   }
+
+   if (!readable) {
+      if (!_table) {
+         std::cout << "Unable to read Whitelist file\n";
+         std::atomic_store(&_table, std::shared_ptr<const Table>(std::make_shared<Table>()));
+      }
+      return;
+   }
+
+   // Build the new table off to the side, then swap it in
+   std::shared_ptr<Table> table = std::make_shared<Table>();
+   size_t start = 0;
+   while (start < data.size()) {
+      size_t end = data.find('\n', start);
+      if (end == std::string::npos)
+         end = data.size();
+
+      std::string line = data.substr(start, end - start);
+      start = end + 1;
+
+      // Trim whitespace (including a \r) and skip blanks and comments
+      size_t first = line.find_first_not_of(" \t\r");
+      if ((first == std::string::npos) || (line[first] == '#'))
+         continue;
+      line = line.substr(first, line.find_last_not_of(" \t\r") - first + 1);
+
+      if (!parseEntry(line, *table))
+         std::cout << "Ignoring invalid whitelist entry: " << line << "\n";
+   }
+
+   _loaded_stat = st;
+   std::atomic_store(&_table, std::shared_ptr<const Table>(table));
+}
+
+/*****************************************************************************************************
+ * parseEntry - adds an address or CIDR subnet to the table
+ *
+ *    Returns: false if the entry isn't a valid address or prefix length
+ *****************************************************************************************************/
+
+bool Whitelist::parseEntry(const std::string &line, Table &table) {
+   std::string addr_str = line;
+   long prefix_len = -1;
+
+   size_t slash = line.find('/');
+   if (slash != std::string::npos) {
+      addr_str = line.substr(0, slash);
+      char *end;
+      prefix_len = strtol(line.c_str() + slash + 1, &end, 10);
+      if ((*end != '\0') || (end == line.c_str() + slash + 1))
+         return false;
+   }
+
+   uint8_t addr[16];
+   if (inet_pton(AF_INET, addr_str.c_str(), addr) == 1) {
+      if (prefix_len == -1)
+         prefix_len = 32;
+      if ((prefix_len < 0) || (prefix_len > 32))
+         return false;
+      table.insert(root_v4, addr, prefix_len);
+   } else if (inet_pton(AF_INET6, addr_str.c_str(), addr) == 1) {
+      if (prefix_len == -1)
+         prefix_len = 128;
+      if ((prefix_len < 0) || (prefix_len > 128))
+         return false;
+      table.insert(root_v6, addr, prefix_len);
+   } else {
+      return false;
+   }
+
+   table.entries++;
+   return true;
+}
+
+/*****************************************************************************************************
+ * Table::insert - adds the first prefix_len bits of addr under the given root. Prefixes already
+ *                 covered by a shorter entry add nothing.
+ *****************************************************************************************************/
+
+void Whitelist::Table::insert(unsigned int root, const uint8_t *addr, unsigned int prefix_len) {
+   uint32_t node = root;
+
+   for (unsigned int i = 0; i < prefix_len; i++) {
+      if (nodes[node].terminal)
+         return;
+
+      unsigned int bit = (addr[i / 8] >> (7 - (i % 8))) & 1;
+      if (nodes[node].child[bit] == 0) {
+         nodes[node].child[bit] = nodes.size();
+         nodes.emplace_back();
+      }
+      node = nodes[node].child[bit];
+   }
+
+   nodes[node].terminal = true;
+}
+
+/*****************************************************************************************************
+ * Table::contains - walks the trie along addr's bits until it reaches an entry (allowed) or runs
+ *                   out of matching nodes (not allowed)
+ *****************************************************************************************************/
+
+bool Whitelist::Table::contains(unsigned int root, const uint8_t *addr, unsigned int bits) const {
+   uint32_t node = root;
+
+   for (unsigned int i = 0; i < bits; i++) {
+      if (nodes[node].terminal)
+         return true;
+
+      node = nodes[node].child[(addr[i / 8] >> (7 - (i % 8))) & 1];
+      if (node == 0)
+         return false;
+   }
+
+   return nodes[node].terminal;
+}
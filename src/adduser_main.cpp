@@ -8,6 +8,8 @@
 
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <getopt.h>
 #include "PasswdMgr.h"
 #include "FileDesc.h"
 #include "strfuncts.h"
@@ -15,7 +17,16 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " <username>\n";
+   std::cout << execname << " [-k <variant>:<t>:<m>:<p>] <username>\n";
+   std::cout << execname << " [-k <variant>:<t>:<m>:<p>] [-m <MiB>] -b <file|->\n";
+   std::cout << execname << " -c\n";
+   std::cout << "   c: convert the legacy text passwd file to the binary format\n";
+   std::cout << "   b: add every user listed in the file (- for stdin), one per line as\n";
+   std::cout << "      name:password, or name::<hash hex>:<salt hex>[:<variant>:<t>:<m>:<p>]\n";
+   std::cout << "      for a password hashed elsewhere. Blank lines and # comments are skipped\n";
+   std::cout << "   m: with -b, memory cap in MiB for hashes running at once (default 256)\n";
+   std::cout << "   k: argon2 variant (i, d or id), passes, KiB of memory and lanes (0 = one per\n";
+   std::cout << "      core) to hash the password with (default i:2:65536:1)\n";
 //   std::cout << "   t: maximum number of threads to use\n";
 //   std::cout << "   n: calculate primes up to the given range\n";
 //   std::cout << "   s: only run in single process mode\n";
@@ -24,20 +35,186 @@ void displayHelp(const char *execname) {
 }
 
 
+/*******************************************************************************************
+ * parseHex - decodes exactly len bytes of hex, false if the text is anything else
+ *******************************************************************************************/
+
+bool parseHex(const std::string &text, size_t len, std::vector<uint8_t> &bytes) {
+   if (text.size() != len * 2)
+      return false;
+
+   bytes.clear();
+   for (size_t i = 0; i < text.size(); i += 2) {
+      char pair[3] = {text[i], text[i + 1], '\0'};
+      char *end;
+      unsigned long val = strtoul(pair, &end, 16);
+      if ((*end != '\0') || !isxdigit((unsigned char) pair[0]))
+         return false;
+      bytes.push_back((uint8_t) val);
+   }
+   return true;
+}
+
+/*******************************************************************************************
+ * parseImportLine - reads one user from a batch file line (see displayHelp)
+ *
+ *    Returns: false if the line is malformed
+ *******************************************************************************************/
+
+bool parseImportLine(const std::string &line, PasswdMgr::NewUser &user) {
+   size_t colon = line.find(':');
+   if ((colon == 0) || (colon == std::string::npos) || (colon + 1 == line.size()) ||
+       (colon >= pwdb_namelen))
+      return false;
+
+   user.entry.name = line.substr(0, colon);
+
+   // name:password
+   if (line[colon + 1] != ':') {
+      user.passwd = line.substr(colon + 1);
+      return true;
+   }
+
+   // name::hash:salt[:params]
+   std::string rest = line.substr(colon + 2), hash, salt, params;
+   size_t next = rest.find(':');
+   if (next == std::string::npos)
+      return false;
+   hash = rest.substr(0, next);
+   salt = rest.substr(next + 1);
+
+   next = salt.find(':');
+   if (next != std::string::npos) {
+      params = salt.substr(next + 1);
+      salt.erase(next);
+      if (!PasswdMgr::parseHashParams(params.c_str(), user.entry.params))
+         return false;
+   }
+
+   return parseHex(hash, pwdb_hashlen, user.entry.hash) && parseHex(salt, pwdb_saltlen, user.entry.salt);
+}
+
+/*******************************************************************************************
+ * importBatch - adds the users listed in a file, or stdin for "-"
+ *
+ *    Returns: the exit code
+ *******************************************************************************************/
+
+int importBatch(PasswdMgr &pwm, const std::string &filename, size_t hash_mem_cap) {
+   std::ifstream file;
+   if (filename != "-") {
+      file.open(filename);
+      if (!file) {
+         cerr << "Could not open " << filename << endl;
+         return -1;
+      }
+   }
+   std::istream &in = (filename != "-") ? file : std::cin;
+
+   std::vector<PasswdMgr::NewUser> users;
+   std::string line;
+   size_t lineno = 0;
+   while (std::getline(in, line)) {
+      lineno++;
+      clrNewlines(line);
+      if (line.empty() || (line[0] == '#'))
+         continue;
+
+      users.emplace_back();
+      if (!parseImportLine(line, users.back())) {
+         cerr << "Line " << lineno << " is not a valid user entry. Nothing was added.\n";
+         return -1;
+      }
+   }
+
+   HashPool pool(HashPool::threadsForCap(hash_mem_cap, pwm.hashMemBytes()));
+   std::vector<std::string> skipped;
+   size_t added;
+   try {
+      added = pwm.importUsers(users, pool, skipped);
+   } catch (pwfile_error &e) {
+      cerr << "Import failed: " << e.what() << endl;
+      return -1;
+   }
+
+   for (const std::string &name : skipped)
+      cerr << "Skipped " << name << ": already has an account or is listed twice\n";
+   cout << "Added " << added << " users.\n";
+   return 0;
+}
+
+
 int main(int argc, char *argv[]) {
 
+   bool convert = false;
+   HashParams hash_params;
+   std::string batch_file;
+   long hash_mem = 256;
+
+   int c = 0;
+   while ((c = getopt(argc, argv, "ck:b:m:")) != -1) {
+      switch (c) {
+      // Convert the password file instead of adding a user
+      case 'c':
+         convert = true;
+         break;
+
+      // Password hashing parameters
+      case 'k':
+         if (!PasswdMgr::parseHashParams(optarg, hash_params)) {
+            cerr << "Invalid hash parameters. Use <i|d|id>:<passes>:<KiB>:<lanes>\n";
+            exit(-1);
+         }
+         break;
+
+      // Add the users listed in a file
+      case 'b':
+         batch_file = optarg;
+         break;
+
+      // Memory cap for parallel hashing
+      case 'm':
+         hash_mem = strtol(optarg, NULL, 10);
+         if (hash_mem < 1) {
+            cerr << "Invalid hash memory cap. Value must be 1 MiB or greater\n";
+            exit(-1);
+         }
+         break;
+
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   PasswdMgr pwm("passwd");
+   pwm.setHashParams(hash_params);
+
+   if (convert) {
+      try {
+         pwm.convertToBinary();
+      } catch (pwfile_error &e) {
+         cerr << "Conversion failed: " << e.what() << endl;
+         exit(-1);
+      }
+      cout << "Password file converted.\n";
+      return 0;
+   }
+
+   if (!batch_file.empty())
+      return importBatch(pwm, batch_file, (size_t) hash_mem * 1024 * 1024);
+
    // Check the command line input
-   if (argc < 2) {
+   if (optind >= argc) {
       displayHelp(argv[0]);
       exit(0);
    }
 
    // Read in the username to add to the password file
-   std::string username(argv[1]);
+   std::string username(argv[optind]);
 
    // Check if the user already exists
    std::vector<uint8_t> hash, salt;
-   PasswdMgr pwm("passwd");
    
    if (pwm.checkUser(username.c_str()))
    {
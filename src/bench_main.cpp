@@ -0,0 +1,124 @@
+/****************************************************************************************
+ * tcpbench - load generator for tcp_server. Runs many concurrent login sessions and
+ *            reports throughput and per-stage latency percentiles
+ *
+ ****************************************************************************************/
+
+#include <stdexcept>
+#include <iostream>
+#include <getopt.h>
+#include "TCPBench.h"
+#include "exceptions.h"
+
+using namespace std;
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-a <ip_addr>] [-p <portnum>] [-u <user>] [-w <password>]";
+   std::cout << " [-c <conns>] [-r <rate>] [-d <secs>] [-k <cmds>] [-x <mix>] [-T <secs>]\n";
+   std::cout << "   a: the IP address of the server (default 127.0.0.1)\n";
+   std::cout << "   p: the port of the server (default 9999)\n";
+   std::cout << "   u/w: the username and password to log in with\n";
+   std::cout << "   c: concurrent sessions (closed loop), or most at once with -r (default 100)\n";
+   std::cout << "   r: open loop--start this many sessions per second\n";
+   std::cout << "   d: seconds to generate load for (default 10)\n";
+   std::cout << "   k: commands each session runs after logging in (default 5)\n";
+   std::cout << "   x: command mix as command=weight pairs (default hello=4,1=1,2=1,5=1)\n";
+   std::cout << "      commands: hello, menu, passwd, 1, 2, 3, 5\n";
+   std::cout << "   T: seconds before a session is counted as failed (default 10)\n";
+}
+
+// global default values
+const unsigned short default_port = 9999;
+const char default_IP[] = "127.0.0.1";
+
+int main(int argc, char *argv[]) {
+
+   TCPBench bench;
+   std::string ip_addr(default_IP);
+   unsigned short port = default_port;
+   std::string username, password;
+
+   int c = 0;
+   long val;
+   while ((c = getopt(argc, argv, "a:p:u:w:c:r:d:k:x:T:")) != -1) {
+      switch (c) {
+      case 'a':
+         ip_addr = optarg;
+         break;
+
+      case 'p':
+         val = strtol(optarg, NULL, 10);
+         if ((val < 1) || (val > 65535)) {
+            std::cout << "Invalid port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         port = (unsigned short) val;
+         break;
+
+      case 'u':
+         username = optarg;
+         break;
+
+      case 'w':
+         password = optarg;
+         break;
+
+      case 'c':
+         val = strtol(optarg, NULL, 10);
+         if (val < 1) {
+            std::cout << "Invalid session count. Value must be 1 or greater\n";
+            exit(0);
+         }
+         bench.setConcurrency((unsigned int) val);
+         break;
+
+      case 'r':
+         bench.setRate(strtod(optarg, NULL));
+         break;
+
+      case 'd':
+         bench.setDuration(strtod(optarg, NULL));
+         break;
+
+      case 'k':
+         bench.setCommands((unsigned int) strtoul(optarg, NULL, 10));
+         break;
+
+      case 'x':
+         if (!bench.setMix(optarg)) {
+            std::cout << "Invalid command mix: " << optarg << "\n";
+            exit(0);
+         }
+         break;
+
+      case 'T':
+         bench.setTimeout(strtod(optarg, NULL));
+         break;
+
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   if (username.empty() || password.empty()) {
+      std::cout << "A username and password (-u, -w) are needed to log in\n";
+      displayHelp(argv[0]);
+      exit(0);
+   }
+
+   try {
+      bench.setTarget(ip_addr.c_str(), port);
+      bench.setLogin(username.c_str(), password.c_str());
+
+      cout << "Loading " << ip_addr << " port " << port << endl;
+      bench.run();
+      bench.report();
+
+   } catch (socket_error &e) {
+      cerr << "Benchmark failed: " << e.what() << endl;
+      return -1;
+   }
+
+   return 0;
+}
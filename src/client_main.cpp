@@ -14,23 +14,52 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " <ip_addr> <port>\n";
+   std::cout << execname << " [-s <script>] [-w <secs>] <ip_addr> <port>\n";
+   std::cout << "   s: send the commands in this file instead of reading stdin, and exit\n";
+   std::cout << "      once the server hangs up\n";
+   std::cout << "   w: with -s, seconds to wait for the server to finish replying (default 5)\n";
 }
 
 
 int main(int argc, char *argv[]) {
 
+   TCPClient client;
+
+   // Get the command line arguments and set params appropriately
+   int c = 0;
+   long val;
+   while ((c = getopt(argc, argv, "s:w:")) != -1) {
+      switch (c) {
+      case 's':
+         client.setScript(optarg);
+         break;
+
+      case 'w':
+         val = strtol(optarg, NULL, 10);
+         if (val < 1) {
+            std::cout << "Invalid wait. Value must be 1 or greater\n";
+            exit(0);
+         }
+         client.setIdleTimeout((unsigned int) val);
+         break;
+
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
    // Check the command line input
-   if (argc < 3) {
+   if (argc - optind < 2) {
       displayHelp(argv[0]);
       exit(0);
    }
 
    // Read in the IP address from the command line
-   std::string ip_addr(argv[1]);
+   std::string ip_addr(argv[optind]);
 
    // Read in the port
-   long portval = strtol(argv[2], NULL, 10);
+   long portval = strtol(argv[optind + 1], NULL, 10);
    if ((portval < 1) || (portval > 65535)) {
       std::cout << "Invalid port. Value must be between 1 and 65535";
       std::cout << "Format: " << argv[0] << " [<max_range>] [<max_threads>]\n";
@@ -39,10 +68,7 @@ int main(int argc, char *argv[]) {
    unsigned short port = (unsigned short) portval;
  
 
-   // Get the command line arguments and set params appropriately
-
    // Try to set up the server for listening
-   TCPClient client;
    try {
       cout << "Connecting to " << ip_addr << " port " << port << endl;
       client.connectTo(ip_addr.c_str(), port);
@@ -0,0 +1,291 @@
+/****************************************************************************************
+ * logdump - decodes, filters and aggregates the binary event log written by tcpserver
+ *
+ *           The log is mapped and walked record by record, so multi-GB logs are
+ *           processed at disk speed. Filters are resolved to ids and raw addresses up
+ *           front, so matching an event never compares strings.
+ *
+ ****************************************************************************************/
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include "EventLog.h"
+
+using namespace std;
+
+const char *event_names[] = {"", "start", "connect", "username", "auth", "passwd", "disconnect",
+                             "dropped", "timeout"};
+const char *outcome_names[] = {"ok", "fail", "rejected"};
+
+void displayHelp(const char *execname) {
+   std::cout << execname << " [-e <event>] [-o <outcome>] [-u <user>] [-i <ip_addr>] [-s <start>]";
+   std::cout << " [-E <end>] [-c] [-U] [-I] <logfile>\n";
+   std::cout << "   e: only events of this type (start, connect, username, auth, passwd,\n";
+   std::cout << "      disconnect, dropped, timeout)\n";
+   std::cout << "   o: only events with this outcome (ok, fail, rejected)\n";
+   std::cout << "   u: only events for this user\n";
+   std::cout << "   i: only events from this IPv4/IPv6 address\n";
+   std::cout << "   s/E: only events at or after start / before end, given as epoch seconds\n";
+   std::cout << "        or YYYY-MM-DDTHH:MM:SS local time\n";
+   std::cout << "   c: count matching events by type and outcome instead of listing them\n";
+   std::cout << "   U: count matching events by user\n";
+   std::cout << "   I: count matching events by address\n";
+}
+
+// Looks a name up in a table of names, -1 if not there
+int findName(const char *name, const char **names, int count) {
+   for (int i = 0; i < count; i++) {
+      if (strcmp(name, names[i]) == 0)
+         return i;
+   }
+   return -1;
+}
+
+// Parses epoch seconds or a local YYYY-MM-DDTHH:MM:SS time into ns since the epoch
+bool parseTime(const char *str, int64_t &ts_ns) {
+   struct tm tmval;
+   memset(&tmval, 0, sizeof(tmval));
+
+   if (strchr(str, '-') != NULL) {
+      const char *end = strptime(str, "%Y-%m-%dT%H:%M:%S", &tmval);
+      if ((end == NULL) || (*end != '\0'))
+         return false;
+      tmval.tm_isdst = -1;
+      ts_ns = (int64_t) mktime(&tmval) * 1000000000LL;
+      return true;
+   }
+
+   char *end;
+   long long secs = strtoll(str, &end, 10);
+   if ((*end != '\0') || (end == str))
+      return false;
+   ts_ns = secs * 1000000000LL;
+   return true;
+}
+
+// Formats the address of an event record
+void formatAddr(const EvRecord &rec, char *buf, size_t len) {
+   if (rec.family == 4)
+      inet_ntop(AF_INET, rec.ev.addr, buf, len);
+   else if (rec.family == 6)
+      inet_ntop(AF_INET6, rec.ev.addr, buf, len);
+   else
+      snprintf(buf, len, "-");
+}
+
+// Prints counts largest first
+void printCounts(unordered_map<string, uint64_t> &counts) {
+   vector<pair<string, uint64_t>> sorted(counts.begin(), counts.end());
+   sort(sorted.begin(), sorted.end(), [](const pair<string, uint64_t> &a,
+                                         const pair<string, uint64_t> &b) {
+      return (a.second > b.second) || ((a.second == b.second) && (a.first < b.first));
+   });
+
+   for (auto &count : sorted)
+      printf("%12llu  %s\n", (unsigned long long) count.second, count.first.c_str());
+}
+
+int main(int argc, char *argv[]) {
+
+   int ev_filter = -1, out_filter = -1;
+   std::string user_filter;
+   int ip_family = 0;
+   uint8_t ip_addr[16];
+   int64_t start_ns = INT64_MIN, end_ns = INT64_MAX;
+   char mode = 'l';
+
+   memset(ip_addr, 0, sizeof(ip_addr));
+
+   int c = 0;
+   while ((c = getopt(argc, argv, "e:o:u:i:s:E:cUI")) != -1) {
+      switch (c) {
+      case 'e':
+         if ((ev_filter = findName(optarg, event_names, ev_max)) < 1) {
+            cerr << "Unknown event type: " << optarg << endl;
+            exit(-1);
+         }
+         break;
+
+      case 'o':
+         if ((out_filter = findName(optarg, outcome_names, out_max)) < 0) {
+            cerr << "Unknown outcome: " << optarg << endl;
+            exit(-1);
+         }
+         break;
+
+      case 'u':
+         user_filter = optarg;
+         break;
+
+      case 'i':
+         if (inet_pton(AF_INET, optarg, ip_addr) == 1)
+            ip_family = 4;
+         else if (inet_pton(AF_INET6, optarg, ip_addr) == 1)
+            ip_family = 6;
+         else {
+            cerr << "Invalid IP address: " << optarg << endl;
+            exit(-1);
+         }
+         break;
+
+      case 's':
+      case 'E':
+         if (!parseTime(optarg, (c == 's') ? start_ns : end_ns)) {
+            cerr << "Invalid time: " << optarg << endl;
+            exit(-1);
+         }
+         break;
+
+      case 'c':
+      case 'U':
+      case 'I':
+         mode = c;
+         break;
+
+      default:
+         displayHelp(argv[0]);
+         exit(0);
+      }
+   }
+
+   if (optind >= argc) {
+      displayHelp(argv[0]);
+      exit(0);
+   }
+
+   // Map the whole log
+   int fd;
+   struct stat st;
+   if (((fd = open(argv[optind], O_RDONLY)) == -1) || (fstat(fd, &st) == -1)) {
+      cerr << "Could not open log file " << argv[optind] << endl;
+      exit(-1);
+   }
+
+   size_t num_recs = st.st_size / sizeof(EvRecord);
+   if (num_recs == 0)
+      return 0;
+
+   void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+   close(fd);
+   if (map == MAP_FAILED) {
+      cerr << "Could not map log file " << argv[optind] << endl;
+      exit(-1);
+   }
+   madvise(map, st.st_size, MADV_SEQUENTIAL);
+
+   const EvRecord *recs = (const EvRecord *) map;
+   if ((recs[0].kind != rec_session) ||
+       (memcmp(recs[0].session.magic, evlog_magic, sizeof(evlog_magic)) != 0)) {
+      cerr << argv[optind] << " is not a tcpserver event log\n";
+      exit(-1);
+   }
+
+   // User names for the current session, and the id matching the user filter (0 = none)
+   vector<string> names;
+   uint32_t user_id = evlog_nouser;
+
+   unordered_map<string, uint64_t> counts;
+   char outbuf[1 << 16];
+   setvbuf(stdout, outbuf, _IOFBF, sizeof(outbuf));
+
+   int64_t cached_sec = INT64_MIN;
+   char datebuf[32] = "";
+
+   for (size_t i = 0; i < num_recs; i++) {
+      const EvRecord &rec = recs[i];
+
+      if (rec.kind == rec_session) {
+         if (rec.session.version != evlog_version) {
+            cerr << "Unsupported event log version " << rec.session.version << endl;
+            exit(-1);
+         }
+         names.clear();
+         names.push_back("");
+         user_id = evlog_nouser;
+         continue;
+      }
+
+      if (rec.kind == rec_name) {
+         if (rec.user_id >= names.size())
+            names.resize(rec.user_id + 1);
+         names[rec.user_id].assign(rec.name, strnlen(rec.name, evlog_namelen));
+         if (names[rec.user_id] == user_filter)
+            user_id = rec.user_id;
+         continue;
+      }
+
+      if ((rec.kind != rec_event) || (rec.event >= ev_max) || (rec.outcome >= out_max))
+         continue;
+
+      // Apply the filters
+      if (((ev_filter >= 0) && (rec.event != ev_filter)) ||
+          ((out_filter >= 0) && (rec.outcome != out_filter)) ||
+          (!user_filter.empty() && ((user_id == evlog_nouser) || (rec.user_id != user_id))) ||
+          ((int64_t) rec.ts_ns < start_ns) || ((int64_t) rec.ts_ns >= end_ns) ||
+          ((ip_family != 0) && ((rec.family != ip_family) ||
+                                (memcmp(rec.ev.addr, ip_addr, (ip_family == 4) ? 4 : 16) != 0))))
+         continue;
+
+      const char *user = (rec.user_id < names.size()) ? names[rec.user_id].c_str() : "";
+      char addrbuf[INET6_ADDRSTRLEN];
+
+      // Rejected connections are logged as one record per interval with the count in value
+      bool aggregated = (rec.event == ev_connect) && (rec.outcome == out_rejected) &&
+                        (rec.family == 0);
+      uint64_t weight = aggregated ? rec.ev.value : 1;
+
+      switch (mode) {
+      case 'c':
+         counts[string(event_names[rec.event]) + " " + outcome_names[rec.outcome]] += weight;
+         break;
+
+      case 'U':
+         counts[(*user == '\0') ? "-" : user] += weight;
+         break;
+
+      case 'I':
+         formatAddr(rec, addrbuf, sizeof(addrbuf));
+         counts[addrbuf] += weight;
+         break;
+
+      default: {
+         int64_t sec = rec.ts_ns / 1000000000;
+         if (sec != cached_sec) {
+            time_t t = sec;
+            struct tm tmval;
+            localtime_r(&t, &tmval);
+            strftime(datebuf, sizeof(datebuf), "%Y-%m-%d %H:%M:%S", &tmval);
+            cached_sec = sec;
+         }
+
+         formatAddr(rec, addrbuf, sizeof(addrbuf));
+         printf("%s.%09llu  %-10s %-8s %-15s %s", datebuf,
+                (unsigned long long) (rec.ts_ns % 1000000000), event_names[rec.event],
+                outcome_names[rec.outcome], addrbuf, (*user == '\0') ? "-" : user);
+         if ((rec.event == ev_dropped) || aggregated)
+            printf("  (%llu)", (unsigned long long) rec.ev.value);
+         printf("\n");
+         break;
+      }
+      }
+   }
+
+   if (mode != 'l')
+      printCounts(counts);
+
+   fflush(stdout);
+   munmap(map, st.st_size);
+   return 0;
+}
@@ -15,9 +15,26 @@
 using namespace std; 
 
 void displayHelp(const char *execname) {
-   std::cout << execname << " [-p <portnum>] [-a <ip_addr>]\n";
+   std::cout << execname << " [-p <portnum>] [-a <ip_addr>] [-t <threads>] [-m <MiB>]";
+   std::cout << " [-f <never|batch|ms>] [-b <backlog>] [-R] [-l <secs>] [-i <secs>]";
+   std::cout << " [-c <secs>] [-C <entries>] [-k <variant>:<t>:<m>:<p>] [-M <port>]\n";
    std::cout << "   p: the port to bind the server to\n";
    std::cout << "   a: the IP address to bind the server\n";
+   std::cout << "   t: run this many event-loop threads (0 = one per core)\n";
+   std::cout << "   m: memory cap in MiB for password hashes running at once (default 256)\n";
+   std::cout << "   f: fsync the log never (default), after every batch, or every ms milliseconds\n";
+   std::cout << "   b: connections the kernel queues for accept (default SOMAXCONN)\n";
+   std::cout << "   R: with -t, give each thread its own SO_REUSEPORT listener\n";
+   std::cout << "   l: seconds allowed to enter each of the username and password (default 30)\n";
+   std::cout << "   i: seconds a logged-in client may sit idle (default 900, 0 = forever)\n";
+   std::cout << "   c: remember successful logins this many seconds so repeats skip the hash\n";
+   std::cout << "      (default 0 = off)\n";
+   std::cout << "   C: most logins remembered with -c (default 4096)\n";
+   std::cout << "   k: argon2 variant (i, d or id), passes, KiB of memory and lanes (0 = one per\n";
+   std::cout << "      core) to hash passwords with (default i:2:65536:1). Users are rehashed\n";
+   std::cout << "      when they next log in\n";
+   std::cout << "   M: record hot-path metrics and serve them in Prometheus text format on\n";
+   std::cout << "      127.0.0.1:<port> (GET /metrics)\n";
 
 }
 
@@ -30,11 +47,21 @@ int main(int argc, char *argv[]) {
 
    unsigned short port = default_port;
    std::string ip_addr(default_IP);
+   long num_threads = -1;
+   long hash_mem = -1;
+   std::string log_sync;
+   long backlog = -1;
+   bool reuseport = false;
+   ConnTimeouts timeouts;
+   long cache_ttl = 0;
+   long cache_entries = 4096;
+   HashParams hash_params;
+   long metrics_port = 0;
 
    // Get the command line arguments and set params appropriately
    int c = 0;
-   long portval;
-   while ((c = getopt(argc, argv, "p:a:smw")) != -1) {
+   long portval, val;
+   while ((c = getopt(argc, argv, "p:a:t:m:f:b:Rl:i:c:C:k:M:")) != -1) {
       switch (c) {
   
       // Set the max number to count up to	    
@@ -53,6 +80,95 @@ int main(int argc, char *argv[]) {
          ip_addr = optarg; 
          break;
 
+      // Number of event-loop threads
+      case 't':
+         num_threads = strtol(optarg, NULL, 10);
+         if (num_threads < 0) {
+            std::cout << "Invalid thread count. Value must be 0 or greater\n";
+            exit(0);
+         }
+         break;
+
+      // Memory cap for concurrent password hashing
+      case 'm':
+         hash_mem = strtol(optarg, NULL, 10);
+         if (hash_mem < 1) {
+            std::cout << "Invalid hash memory cap. Value must be 1 MiB or greater\n";
+            exit(0);
+         }
+         break;
+
+      // Log fsync policy
+      case 'f':
+         log_sync = optarg;
+         if ((log_sync != "never") && (log_sync != "batch") && (strtol(optarg, NULL, 10) < 1)) {
+            std::cout << "Invalid fsync policy. Use never, batch or a number of milliseconds\n";
+            exit(0);
+         }
+         break;
+
+      // Accept queue length
+      case 'b':
+         backlog = strtol(optarg, NULL, 10);
+         if (backlog < 1) {
+            std::cout << "Invalid backlog. Value must be 1 or greater\n";
+            exit(0);
+         }
+         break;
+
+      // Shard accepts across the threads
+      case 'R':
+         reuseport = true;
+         break;
+
+      // Login and idle timeouts
+      case 'l':
+      case 'i':
+         val = strtol(optarg, NULL, 10);
+         if (val < 0) {
+            std::cout << "Invalid timeout. Value must be 0 (never) or more seconds\n";
+            exit(0);
+         }
+         if (c == 'i')
+            timeouts.idle = (unsigned int) val;
+         else
+            timeouts.username = timeouts.passwd = (unsigned int) val;
+         break;
+
+      // Credential cache
+      case 'c':
+         cache_ttl = strtol(optarg, NULL, 10);
+         if (cache_ttl < 0) {
+            std::cout << "Invalid cache time. Value must be 0 (off) or more seconds\n";
+            exit(0);
+         }
+         break;
+
+      case 'C':
+         cache_entries = strtol(optarg, NULL, 10);
+         if (cache_entries < AuthCache::ways) {
+            std::cout << "Invalid cache size. Value must be " << AuthCache::ways << " or greater\n";
+            exit(0);
+         }
+         break;
+
+      // Password hashing parameters
+      case 'k':
+         if (!PasswdMgr::parseHashParams(optarg, hash_params)) {
+            std::cout << "Invalid hash parameters. Use <i|d|id>:<passes>:<KiB>:<lanes>\n";
+            exit(0);
+         }
+         break;
+
+      // Metrics endpoint
+      case 'M':
+         metrics_port = strtol(optarg, NULL, 10);
+         if ((metrics_port < 1) || (metrics_port > 65535)) {
+            std::cout << "Invalid metrics port. Value must be between 1 and 65535\n";
+            exit(0);
+         }
+         break;
+
       case '?':
 	      displayHelp(argv[0]);
 	      break;
@@ -67,6 +183,25 @@ int main(int argc, char *argv[]) {
 
    // Try to set up the server for listening
    TCPServer server;
+   if (num_threads >= 0)
+      server.setNumThreads((unsigned int) num_threads);
+   if (hash_mem > 0)
+      server.setHashMemCap((unsigned int) hash_mem);
+   if (log_sync == "batch")
+      server.setLogSync(LogSvr::sync_batch);
+   else if (!log_sync.empty() && (log_sync != "never"))
+      server.setLogSync(LogSvr::sync_interval, (unsigned int) strtol(log_sync.c_str(), NULL, 10));
+   server.setTimeouts(timeouts);
+   if (backlog > 0)
+      server.setBacklog((int) backlog);
+   if (reuseport && (num_threads >= 0))
+      server.setReusePort(true);
+   if (cache_ttl > 0)
+      server.setAuthCache((unsigned int) cache_ttl, (size_t) cache_entries);
+   server.setHashParams(hash_params);
+   if (metrics_port > 0)
+      server.setMetricsPort((unsigned short) metrics_port);
+
    try {
       cout << "Binding server to " << ip_addr << " port " << port << endl;
       server.bindSvr(ip_addr.c_str(), port);
@@ -90,6 +225,10 @@ int main(int argc, char *argv[]) {
       cerr << "Unrecoverable socket error. Exiting.\n";
       cerr << "Error is: " << e.what() << endl;
       return -1;
+   } catch (std::exception &e) {
+      cerr << "Unrecoverable error. Exiting.\n";
+      cerr << "Error is: " << e.what() << endl;
+      return -1;
    }
 
 